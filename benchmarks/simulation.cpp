@@ -0,0 +1,133 @@
+// Microbenchmarks for the simulation core. No X server is needed.
+// Usage: simulation-benchmark [MAX_DRAGONS]	(default 100000)
+
+#include "animation.h"
+#include "separation.h"
+#include "pool.h"
+#include "timers.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+
+
+static const auto MinDuration = chrono::milliseconds(200);	// Per measurement. Repeats until reached.
+static const uint_fast64_t AgingSteps = 14;	// Animation::maturing_resolution, in 150 ms simulation steps.
+
+// Calls step until MinDuration has passed, returning nanoseconds per item.
+double measure(size_t items, const function<void()> &step) {
+	step();	// Warm up.
+	uint_fast64_t rounds = 0;
+	const auto started = chrono::steady_clock::now();
+	chrono::steady_clock::duration elapsed;
+	do {
+		step();
+		rounds++;
+	} while ((elapsed = chrono::steady_clock::now() - started) < MinDuration);
+	return (double)chrono::duration_cast<chrono::nanoseconds>(elapsed).count() / (rounds * items);
+}
+
+void place_cursor(Position p) {
+	cursor_effect_area = {
+		.origin = {
+			(Distance)(p.x - CursorEffectDistancePixels),
+			(Distance)(p.y - CursorEffectDistancePixels)
+		},
+		.width = 2 * CursorEffectDistancePixels,
+		.height = 2 * CursorEffectDistancePixels,
+		.center = p
+	};
+}
+
+volatile uint_fast64_t sink;	// Keeps results of pure functions from being optimised away.
+
+int main(int argc, char *argv[]) {
+	const size_t max_dragons = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+
+	// move() logs escape manoeuvres to stdout. Results go to stderr, so they can be read on their own.
+	if (!freopen("/dev/null", "w", stdout)) perror("Failed to silence stdout");
+
+	// Roughly the size of the bundled frames, on a 1080p screen.
+	Animation::initial_width = 180;
+	Animation::initial_height = 140;
+	Animation::frame_count = 4;
+	win_area = {.origin = {0, 0}, .width = 1920, .height = 1080, .center = {960, 540}};
+
+	fprintf(stderr, "%8s %12s %12s %12s %12s %12s %12s %12s %12s\n",
+		"dragons", "move", "evasion", "separation", "aging", "point_in", "overlap", "heading", "distance"
+	);
+	for (size_t n = 10; n <= max_dragons; n *= 10) {
+		AnimationPool pool;
+		pool.reserve(n);
+		vector<Animation*> dragons;
+		for (size_t i = 0; i < n; i++) {
+			Animation *a = pool.acquire();
+			a->reset();
+			dragons.push_back(a);
+		}
+		mt19937 rng(n);
+
+		// Cursor in a corner, away from most dragons.
+		place_cursor({0, 0});
+		const double move_ns = measure(n, [&] {
+			for (auto d : dragons) d->move(rng);
+		});
+
+		// Cursor over every dragon, so all of them evade.
+		const double evasion_ns = measure(n, [&] {
+			for (auto d : dragons) {
+				place_cursor(d->area.center);
+				d->move(rng);
+			}
+		});
+
+		SeparationGrid broad_phase;
+		const double separation_ns = measure(n, [&] {
+			broad_phase.update(dragons);
+			for (auto d : dragons) d->separation_vector = {0, 0};
+		});
+
+		// Growth timers spread evenly over the steps, as they are when dragons spawn at different times.
+		TimerWheel<Animation*> timers;
+		for (size_t i = 0; i < n; i++) timers.schedule(1 + i % AgingSteps, dragons[i]);
+		const auto now = chrono::steady_clock::now();
+		const double aging_ns = measure(n, [&] {
+			timers.advance([&](Animation *d) {
+				d->grow(now);
+				timers.schedule(AgingSteps, d);
+			});
+		});
+
+		const double point_ns = measure(n, [&] {
+			uint_fast64_t hits = 0;
+			for (auto d : dragons) hits += point_within_area(cursor_effect_area.center, d->area);
+			sink = hits;
+		});
+		const double overlap_ns = measure(n, [&] {
+			uint_fast64_t apart = 0;
+			for (auto d : dragons) apart += areas_are_not_overlapping(&cursor_effect_area, &d->area);
+			sink = apart;
+		});
+		const double heading_ns = measure(n, [&] {
+			Fixed total = 0;
+			for (auto d : dragons) {
+				const PreciseHeading h = get_heading(d->area.center, win_area.center);
+				total += h.x + h.y;
+			}
+			sink = total;
+		});
+		const double distance_ns = measure(n, [&] {
+			Distance total = 0;
+			for (auto d : dragons) {
+				const DistancePair p = abs_distance_between(d->area.center, cursor_effect_area.center);
+				total += p.x + p.y;
+			}
+			sink = total;
+		});
+
+		fprintf(stderr, "%8zu %10.1fns %10.1fns %10.1fns %10.1fns %10.1fns %10.1fns %10.1fns %10.1fns\n",
+			n, move_ns, evasion_ns, separation_ns, aging_ns, point_ns, overlap_ns, heading_ns, distance_ns
+		);
+	}
+	return 0;
+}
@@ -1,8 +1,10 @@
 #pragma once
 
-#include "render.h"
+// The simulation has no X dependency. Drawing is left to the X layer, which reads snapshots (see snapshot.h).
 
 #include <vector>	// In header for pair.
+#include <cstdint>
+#include <cmath>	// For round.
 
 #include <random>	// For generating positions.
 
@@ -16,22 +18,37 @@
 using namespace std;
 
 using Distance = int_fast16_t;
+
+// 16.16 fixed point, as XRender uses, for kinematics finer than a pixel without floating point.
+using Fixed = int32_t;
+constexpr Fixed FixedOne = 1 << 16;
+constexpr Fixed to_fixed(Fixed d) {return d * FixedOne;}
+constexpr Distance whole(Fixed f) {return f >> 16;}	// Rounds down, for negative values too.
+constexpr Fixed fraction(Fixed f) {return f & (FixedOne - 1);}
+constexpr Fixed fixed_mul(Fixed a, Fixed b) {return ((int64_t)a * b) >> 16;}
+constexpr Fixed round_fixed(Fixed f) {return (f + FixedOne / 2) & ~(FixedOne - 1);}	// To the nearest whole number, halves up.
+
 typedef struct {
 	// Signedness is critical here, representing directionality.
-	Distance x;
-	Distance y;
+	// Pixels per base step (see Animation::step_scale), in 16.16.
+	Fixed x;
+	Fixed y;
 	operator bool() const {return (x || y);};
 } Speed;
 typedef struct {
-	float x;
-	float y;
+	// Fractions of the distance along each axis, so abs(x) + abs(y) is one. In 16.16.
+	Fixed x;
+	Fixed y;
 } PreciseHeading;
 typedef struct {
 	// Using signed integers to allow for detection of negative values.
 	Distance x;
 	Distance y;
-	operator Speed() {return Speed{x, y};}
 } Position;
+typedef struct {
+	Fixed x;
+	Fixed y;
+} FixedPosition;
 using DistancePair = Position;
 
 typedef struct {
@@ -80,16 +97,18 @@ DistancePair inline abs_distance_between(const Position &a, const Position &b) {
 Distance inline abs_sum(const Distance &a, const Distance &b) {
 	return abs(a) + abs(b);
 }
-Distance inline abs_total(const Speed &s) {
+Fixed inline abs_total(const Speed &s) {
 	return abs(s.x) + abs(s.y);
 }
 
 PreciseHeading inline get_heading(const Position &from, const Position &to) {
-	const Speed vector_between = distance_between(from, to);
-	const auto abs_sum_vector_between = abs_sum(vector_between.x, vector_between.y);
+	// Zero between identical positions.
+	const DistancePair vector_between = distance_between(from, to);
+	const Fixed abs_sum_vector_between = abs_sum(vector_between.x, vector_between.y);
+	if (!abs_sum_vector_between) return {0, 0};
 	return {
-		(float)(vector_between.x) / abs_sum_vector_between,
-		(float)(vector_between.y) / abs_sum_vector_between
+		(Fixed)(to_fixed(vector_between.x) / abs_sum_vector_between),
+		(Fixed)(to_fixed(vector_between.y) / abs_sum_vector_between)
 	};
 }
 
@@ -129,9 +148,10 @@ T lesser_abs_magnitude(const T &a, const U &b) {
 Position get_random_position(unsigned short x_max, unsigned short y_max);
 
 Speed get_random_speed(short min, short max);	// "Speed" really shouldn't refer to a pair. Fix later.
+Speed get_random_speed(short min, short max, mt19937 &gen);	// Uses the caller's generator, for reproducible streams.
 
 
-void inline move_toward_limit(int_fast16_t * const speed, uint_fast16_t change, const short limit) {
+void inline move_toward_limit(Fixed * const speed, Fixed change, const Fixed limit) {
 	// This uses the valance of limit provided.
 	// Resulting speed will be within the range of (speed,limit), allowing for either to be positive or negative.
 	if (*speed == limit) return;
@@ -150,7 +170,7 @@ void inline move_toward_limit(int_fast16_t * const speed, uint_fast16_t change,
 		}
 	}
 }
-void inline abs_move_within_limit(int_fast16_t * const speed, const uint_fast16_t change, const unsigned short limit) {
+void inline abs_move_within_limit(Fixed * const speed, const Fixed change, const Fixed limit) {
 	// This uses the valance of speed provided.
 	// Resulting speed will be bound within the range of EITHER (-limit,0) OR (0,limit).
 	if (change == 0) return;
@@ -163,7 +183,7 @@ void inline abs_move_within_limit(int_fast16_t * const speed, const uint_fast16_
 		if ((*speed -= change) < -limit) *speed = -limit;
 	}
 }
-void inline move_within_abs_limit(int_fast16_t * const speed, int_fast16_t change, const unsigned short limit) {
+void inline move_within_abs_limit(Fixed * const speed, Fixed change, const Fixed limit) {
 	// This uses the valance of change provided. Only speed and limit are absolute!
 	// Resulting speed will be bound within the range of (-limit,limit).
 	if (change == 0) return;
@@ -172,6 +192,14 @@ void inline move_within_abs_limit(int_fast16_t * const speed, int_fast16_t chang
 }
 
 
+// Number of mip levels, each half the size of the last, needed to reach scale s without sampling below half a level.
+constexpr uint_fast8_t count_mip_levels(float s) {
+	uint_fast8_t levels = 1;
+	for (float level_scale = 0.5; level_scale >= s; level_scale /= 2) levels++;
+	return levels;
+}
+
+
 class Animation {
 	public:
 		enum X_orientation {
@@ -201,14 +229,15 @@ class Animation {
 		;
 		Speed evasion_vector = {0};	// Last known escape vector. Decremented to zero, triggering return to NormalMode.
 		static const uint_fast8_t max_evasion_distance = 80;
+		// Sum of pushes away from nearby dragons, accumulated by the separation broad phase. Cleared by move().
+		Speed separation_vector = {0};
+		static const unsigned short max_separation_accel = max_accel * 2;
 
-
-		static inline vector<xcb_pixmap_t> pixmaps;
-		vector<xcb_render_picture_t>
-			nat_pics,
-			x_unat_pics
-		;
-		vector<xcb_render_picture_t> *pictures;
+		// Speeds and accelerations above are per base step. Each simulation step covers this much of one, in 16.16,
+		// so a faster step rate moves dragons as far each second, in smaller increments.
+		static inline Fixed step_scale = FixedOne;
+		static Fixed per_step(Fixed f) {return fixed_mul(f, step_scale);}
+		static Speed per_step(const Speed &s) {return Speed{per_step(s.x), per_step(s.y)};}
 
 
 		static inline unsigned short
@@ -219,65 +248,85 @@ class Animation {
 			min_scale = 0.2,
 			max_scale = 2
 		;
+
+		// Each frame is drawn from pre-filtered levels, so small dragons are sampled from a small source.
+		// Only the residual scale, between 0.5 and 1 below full size, is left to the renderer.
+		static constexpr uint_fast8_t mip_levels = count_mip_levels(min_scale);
+		static uint_fast8_t level_for(float s) {
+			uint_fast8_t level = 0;
+			while (level + 1 < mip_levels && 1.0f / (1 << (level + 1)) >= s) level++;
+			return level;
+		}
+		uint_fast8_t level = level_for(min_scale);
+
+		static inline uint_fast16_t frame_count = 1;	// Animation frames, set once they are loaded.
+		uint_fast32_t slot = 0;	// Index in the owning pool, which the X layer uses for its per-slot pictures.
+
 		static constexpr auto
 			max_maturity = chrono::seconds(20),
 			maturing_resolution = chrono::seconds(2)
 		;
-		const chrono::time_point<chrono::system_clock> born = chrono::high_resolution_clock::now();
-		chrono::time_point<chrono::system_clock> last_aged = born;
+		chrono::steady_clock::time_point born = chrono::steady_clock::now();
 		bool fully_mature = false;
+		float scale = min_scale;
 		Area area = {
 			.width = (Distance)(initial_width * min_scale),
 			.height = (Distance)(initial_height * min_scale)
 		};
 
 
-		vector<xcb_render_picture_t>::iterator stage;
+		uint_fast16_t stage = 0;	// Current animation frame.
+		Fixed stage_progress = 0;	// Toward the next frame, which is due every base step.
 		Speed speed;
+		FixedPosition position;	// Exact origin. area.origin holds its whole pixels.
+
+
+		// The life, incremented by reset() so pooled instances can tell their lives apart, shifted up past a dead bit.
+		// One word, so a kill can only ever land on the life it was aimed at, even while reset() starts the next.
+		atomic<uint32_t> state {0};
+		uint_fast32_t life() const {return state.load() >> 1;}
+		bool dead() const {return state.load() & 1;}	// Set by the event thread through kill().
+		chrono::steady_clock::time_point killed_at;	// When the click was received. Valid once dead is seen.
+		bool kill(uint_fast32_t of_life, chrono::steady_clock::time_point when) {	// Returns true if this call killed the dragon.
+			uint32_t alive = (uint32_t)of_life << 1;
+			if (state.load() != alive) return false;
+			killed_at = when;	// Only the event thread kills, so this can be written before dead.
+			return state.compare_exchange_strong(alive, alive | 1);
+		}
 
 
-		bool dead = false;
-
-
-		Animation();
-		~Animation();
+		void reset(chrono::steady_clock::time_point now = chrono::steady_clock::now());	// Restore kinematic state for a fresh spawn. Call before each use.
 
 
 		void reorient_x();
-		void move();
+		// Random acceleration is drawn from rng, so results depend only on its stream.
+		// Without look_for_cursor, evasion already under way carries on but the cursor is not checked.
+		void move(mt19937 &rng, bool look_for_cursor = true);
 
 		Speed inline get_escape_vector(const Area * const a);
+		void steer_away_from(const Area &other);
 
 
-		void age();
+		// Apply the scale for the age at now. Called by the owner's timers every maturing_resolution, until fully_mature.
+		void grow(chrono::steady_clock::time_point now);
+		void set_scale(float s);
+
+		inline void advance_stage() {
+			for (stage_progress += step_scale; stage_progress >= FixedOne; stage_progress -= FixedOne) {
+				if (++stage == frame_count) stage = 0;
+			}
+		}
+		inline uint_fast16_t frame_index() const {
+			return stage;
+		}
 
+		inline void snap_origin() {
+			area.origin = {whole(position.x), whole(position.y)};
+		}
 		inline void recalculate_center() { 
 			area.center = {
 				area.origin.x + (area.width/2),
 				area.origin.y + (area.height/2)
 			};
 		}
-
-
-		static inline xcb_render_transform_t scale(float s) {
-			return mft(
-				1, 0, 0,
-				0, 1, 0,
-				0, 0, s
-			);
-		}
-		inline xcb_render_transform_t flip_x() {
-			return mft(
-			 	  -1,     0,  area.width,
-				   0,     1,           0,
-				   0,     0,           1
-			);
-		}
-		inline xcb_render_transform_t scale_flip_x(float s) {
-			return mft(
-			 	  -1,     0,  area.width,
-				   0,     1,           0,
-				   0,     0,           s
-			);
-		}
 };
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "animation.h"
+#include "backend.h"	// For FrameImage.
+#include "rle.h"
+
+#include <xcb/xcb.h>
+
+
+// Keeps every frame at every mip level in a few large server pixmaps ("pages"), packed onto shelves.
+// Pixels stay on the client too, run-length encoded, so under a memory budget the least recently drawn entries can be
+// evicted and uploaded again when next drawn. Used from the render thread only.
+class SpriteAtlas {
+	public:
+		static constexpr uint16_t
+			PageSize = 1024,	// Width and height of each page, unless a single entry needs more.
+			Gutter = 2		// Transparent pixels around each entry, covering filtering and offset rounding.
+		;
+
+		typedef struct {
+			uint16_t page;
+			int16_t x, y;		// Of the frame's top left, inside the gutter.
+		} Placement;
+
+		size_t budget = 0;	// Bytes of pages on the server. Zero for no limit. At least one page is always allowed.
+
+		void init(xcb_connection_t *c, xcb_drawable_t d, xcb_gcontext_t g);
+		// Keeps encoded copies of the frames and their mip levels, then uploads as many as fit in the budget.
+		bool load(const vector<FrameImage> &frames, const string &cache_dir);
+		// Where a frame's level is on the server, uploading it first if it isn't resident. nullptr if it can't be.
+		// now orders entries for eviction: those drawn longest ago go first.
+		const Placement *place(uint_fast16_t frame, uint_fast8_t level, uint_fast64_t now);
+		void release();	// Frees the pages. Call before disconnecting.
+
+		size_t page_count() const {return pages.size();}
+		xcb_pixmap_t page(size_t i) const {return pages[i].pixmap;}
+		size_t resident_bytes() const {return resident;}
+		size_t client_bytes() const;	// Of the encoded copies.
+
+	private:
+		typedef struct {
+			uint16_t page;
+			int16_t x, y;
+			uint16_t width, height;
+		} Rect;
+
+		typedef struct {
+			uint16_t y, height, used;	// Width used from the left.
+		} Shelf;
+
+		typedef struct {
+			xcb_pixmap_t pixmap;
+			vector<Shelf> shelves;
+			uint16_t used;		// Height used by shelves from the top.
+			vector<Rect> free;	// Rectangles of evicted entries, split up as smaller entries reuse them.
+			size_t entries;		// Resident. A page left empty is repacked from scratch.
+		} Page;
+
+		typedef struct {
+			uint16_t width, height;	// Of the pixels, not counting the gutter.
+			const RleSprite *sprite;	// Client copy, in sprites.
+			bool resident;
+			Rect rect;		// With the gutter. Valid while resident.
+			Placement placement;
+			uint_fast64_t last_drawn;
+		} Entry;
+
+		xcb_connection_t *conn = nullptr;
+		xcb_drawable_t drawable;	// For the pages' screen and depth.
+		xcb_gcontext_t gc;
+		uint16_t page_width = PageSize, page_height = PageSize;
+		size_t max_pages = 0;	// Zero for no limit.
+
+		vector<RleSprite> sprites[Animation::mip_levels];	// Indexed by level, then frame.
+		vector<Entry> entries[Animation::mip_levels];	// Likewise.
+		uint16_t slot_width[Animation::mip_levels], slot_height[Animation::mip_levels];	// Rectangle for every entry of a level, with gutters.
+		vector<Page> pages;
+		size_t resident = 0;	// Bytes of resident entries, not counting gutters.
+		vector<uint32_t> padded;	// Upload buffer, reused.
+
+		bool allocate(uint16_t width, uint16_t height, Rect *r);
+		bool add_page();
+		bool evict_least_recent(uint_fast64_t now);
+		void upload(Entry &e);
+};
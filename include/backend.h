@@ -0,0 +1,96 @@
+#pragma once
+
+#include "snapshot.h"
+
+#include <cstdio>
+#include <memory>	// For unique_ptr.
+
+
+// One animation frame as loaded from a bitmap: straight (not premultiplied) 32-bit BGRA, top row first.
+typedef struct {
+	uint16_t width, height;
+	vector<uint8_t> bgra;
+} FrameImage;
+
+
+// Turns snapshots into drawing. Each frame is begin_frame(), then draw_sprite() for every dragon from bottom to top,
+// then draw_sparks() once for all the sparks, then end_frame(). Drawing happens on one thread.
+// reserve_slots() may be called from another (the spawn thread).
+class RenderBackend {
+	public:
+		virtual ~RenderBackend() = default;
+
+		virtual bool upload_frames(const vector<FrameImage> &frames) = 0;
+		virtual void reserve_slots(size_t slots) {}	// Prepare whatever is kept per pool slot, for slots below this count.
+		virtual void invalidate(int16_t x, int16_t y, uint16_t width, uint16_t height) {}	// The background changed here.
+		virtual void set_smooth_scaling(bool smooth) {}	// Interpolate scaled sprites, or sample the nearest pixel.
+
+		virtual void begin_frame(uint_fast64_t frame_number) = 0;
+		virtual void draw_sprite(const DragonSnapshot &d) = 0;
+		virtual void draw_sparks(const vector<SparkSnapshot> &sparks) {}
+		virtual void end_frame() = 0;
+
+		// Whether end_frame() returns before the server has drawn the frame. If so, await_completion() waits until it has.
+		// begin_frame() waits too, so the time the server takes is never left out of one frame and counted in the next.
+		virtual bool completes_on_server() const {return false;}
+		virtual void await_completion() {}
+
+		virtual void release() {}	// Free server-side resources. Call before disconnecting.
+		virtual void print_summary(FILE *out) const {}
+};
+
+
+// Draws nothing and only counts operations, for measuring everything except the X server.
+class NullBackend : public RenderBackend {
+	public:
+		bool upload_frames(const vector<FrameImage> &frames) override;
+		void invalidate(int16_t x, int16_t y, uint16_t width, uint16_t height) override {invalidations++;}
+
+		void begin_frame(uint_fast64_t frame_number) override {frames++;}
+		void draw_sprite(const DragonSnapshot &d) override {sprites++;}
+		void draw_sparks(const vector<SparkSnapshot> &s) override {sparks += s.size();}
+		void end_frame() override {}
+
+		void print_summary(FILE *out) const override;
+
+	private:
+		uint_fast64_t uploads = 0, frames = 0, sprites = 0, sparks = 0, invalidations = 0;
+};
+
+
+// Writes every operation to a text file, one per line, then passes it on to another backend (if given).
+// Lines are:
+//	upload <index> <width> <height>
+//	begin <frame number> <microseconds since recording started>
+//	sprite <slot> <life> <frame> <level> <x> <y> <width> <height> <left|right>
+//	sparks <count>
+//	invalidate <x> <y> <width> <height>
+//	end
+class RecordingBackend : public RenderBackend {
+	public:
+		RecordingBackend(const char *path, unique_ptr<RenderBackend> next);	// Prints an error and records nothing if path can't be opened.
+		~RecordingBackend();
+
+		bool upload_frames(const vector<FrameImage> &frames) override;
+		void reserve_slots(size_t slots) override;
+		void invalidate(int16_t x, int16_t y, uint16_t width, uint16_t height) override;
+		void set_smooth_scaling(bool smooth) override {if (next) next->set_smooth_scaling(smooth);}
+
+		void begin_frame(uint_fast64_t frame_number) override;
+		void draw_sprite(const DragonSnapshot &d) override;
+		void draw_sparks(const vector<SparkSnapshot> &sparks) override;
+		void end_frame() override;
+
+		bool completes_on_server() const override {return next && next->completes_on_server();}
+		void await_completion() override {if (next) next->await_completion();}
+
+		void release() override;
+		void print_summary(FILE *out) const override;
+
+	private:
+		unique_ptr<RenderBackend> next;
+		FILE *file = nullptr;
+		vector<char> buffer;	// For file. Large, so recording rarely waits on the disk.
+		chrono::steady_clock::time_point started = chrono::steady_clock::now();
+		uint_fast64_t commands = 0;
+};
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <xcb/xcb.h>
+#include <xcb/damage.h>
+#include <xcb/render.h>
+
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+
+// Keeps the pseudo-transparency background (fake_bg) up to date with the desktop beneath the window.
+// Top-level windows are redirected automatically, so their contents stay readable while our window covers them.
+// Damage reports which parts changed, and only those are repainted: the root background first, then every window
+// overlapping the damage, bottom to top.
+class LiveBackground {
+	public:
+		// Pixels repainted per refresh(). Larger damage is spread over later frames instead of stalling one.
+		static const uint32_t RefreshBudgetPixels = 1 << 19;
+
+		// Events and damage tracking use c. Pictures and repaints use draw, which may be the same connection.
+		bool init(xcb_connection_t *c, xcb_connection_t *draw, xcb_screen_t *screen, xcb_pixmap_t target, xcb_render_pictformat_t target_format, vector<xcb_window_t> ignored);
+		void release();
+
+		// Called from the event loop. Returns true if the event was consumed.
+		bool handle_event(const xcb_generic_event_t *gen_e);
+
+		// Repaint pending damage into the target. Rectangles repainted are appended to refreshed, if given.
+		void refresh(vector<xcb_rectangle_t> *refreshed = nullptr);
+
+	private:
+		typedef struct {
+			xcb_window_t window;
+			xcb_damage_damage_t damage;
+			xcb_render_picture_t picture;
+			xcb_rectangle_t geometry;	// Root coordinates, including border.
+			bool mapped;
+		} Window;
+
+		xcb_connection_t *conn = nullptr;
+		xcb_connection_t *draw_conn = nullptr;	// Pictures are created, used and freed on it in that order, so no fences are needed.
+		xcb_window_t root;
+		xcb_render_picture_t root_picture = 0, target_picture = 0;
+		uint8_t damage_event = 0;
+		vector<xcb_window_t> ignored;	// Our own windows.
+		vector<xcb_render_pictvisual_t> visual_formats;
+
+		mutex m;	// Guards windows and pending, shared by the event and render threads.
+		vector<Window> windows;	// Stacking order, bottom first.
+		vector<xcb_rectangle_t> pending;	// Root coordinates.
+
+		vector<Window>::iterator find(xcb_window_t w);
+		void track(const vector<xcb_window_t> &new_windows);	// Adds to the top of the stack.
+		void untrack(vector<Window>::iterator w, bool destroyed);
+		void damage(const xcb_rectangle_t &r);
+		void restack(xcb_window_t w, xcb_window_t above);
+		xcb_render_pictformat_t format_for_visual(xcb_visualid_t v) const;
+};
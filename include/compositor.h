@@ -0,0 +1,63 @@
+#pragma once
+
+#include "snapshot.h"
+#include "rle.h"
+#include <xcb/shm.h>
+
+
+// Client-side sprite, stored as premultiplied ARGB32, from straight (not premultiplied) 32-bit BGRA pixel data,
+// as loaded from a bitmap.
+RleSprite make_sprite(uint16_t width, uint16_t height, const uint8_t *bgra);
+
+
+// Composites dragons into a client-side frame buffer and presents it with MIT-SHM.
+// For servers with slow RENDER implementations: blending happens here, with SSE2 or AVX2 when available,
+// and the server only copies the damaged spans of the frame from shared memory.
+class SoftwareCompositor {
+	public:
+		enum Filter {
+			Nearest,
+			Bilinear
+		};
+		Filter filter = Bilinear;	// For sprites drawn at a scale other than 1.
+
+		vector<RleSprite> sprites[Animation::mip_levels];	// Indexed by mip level, then animation frame.
+
+		// background is copied once (through shared memory) and restored under dragons every frame.
+		// Pass XCB_NONE for a transparent background.
+		bool init(xcb_connection_t *c, xcb_drawable_t target, xcb_gcontext_t target_gc, uint16_t w, uint16_t h, xcb_drawable_t background);
+		void release();
+
+		void draw(const FrameSnapshot &snapshot);
+		// Re-read parts of the background that changed on the server. They are redrawn with the next frame.
+		void update_background(xcb_drawable_t bg, const vector<xcb_rectangle_t> &rects);
+
+	private:
+		xcb_connection_t *conn = nullptr;
+		xcb_drawable_t target;
+		xcb_gcontext_t gc;
+		uint16_t width = 0, height = 0;
+
+		int shm_id = -1;
+		xcb_shm_seg_t segment = 0;
+		uint32_t *frame = nullptr;	// Shared with the server.
+		xcb_void_cookie_t last_put = {0};	// Server may still be reading frame until this is checked.
+
+		vector<uint32_t> background;
+		vector<xcb_rectangle_t> previous, current;	// Dragon and spark rectangles, clipped to the frame.
+		// Part of the damage within one band of rows. Spans that overlap within a band are pushed together.
+		typedef struct {
+			uint16_t band;
+			int16_t x0, y0, x1, y1;	// Right and bottom edges excluded.
+		} Span;
+		static const uint16_t BandHeight = 64;	// Rows per band.
+		vector<Span> damage;
+		vector<uint32_t> row;	// One row of sampled source pixels.
+		vector<uint32_t> decoded;	// Two rows of the sprite being drawn, when it is scaled or flipped.
+
+		bool clip(const DragonSnapshot &d, xcb_rectangle_t *r) const;
+		void restore(const xcb_rectangle_t &r);
+		void blend(const DragonSnapshot &d, const xcb_rectangle_t &r);
+		void fill(const xcb_rectangle_t &r, uint32_t colour);	// Blends a premultiplied colour over r.
+		void push_damage();	// Copies everything in previous and current to the server.
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+using namespace std;
+
+
+// Holds the frame time under a budget by stepping through quality tiers. Each tier keeps the savings of those before it.
+// Steps down soon after the rolling frame time goes over budget, and back up only after it has stayed well under,
+// so the tier doesn't flip back and forth around the budget.
+class QualityGovernor {
+	public:
+		enum Tier : uint_fast8_t {
+			Full,
+			NearestFilter,		// Scaled sprites are sampled without interpolation.
+			HeldFrames,		// Animation frames advance every other step.
+			SparseEvasion,		// Dragons far from the cursor look for it every other step.
+			ThrottledSpawns,	// Spawn intervals are doubled.
+			TierCount
+		};
+
+		chrono::microseconds budget {0};	// Zero disables the governor, leaving the tier at Full.
+
+		Tier record(chrono::steady_clock::duration frame_time);	// Call once per frame, from one thread. Returns the new tier.
+		Tier tier() const {return current.load(memory_order_relaxed);}	// From any thread.
+
+	private:
+		static constexpr float
+			Smoothing = 1.0f / 8,	// Weight of the latest frame in the rolling average.
+			Headroom = 0.6f		// Fraction of the budget the average must fall under before stepping up.
+		;
+		static const uint_fast16_t
+			SettleFrames = 8,	// Frames after a change before stepping down again.
+			RecoverFrames = 32	// Frames after a change before stepping up.
+		;
+
+		atomic<Tier> current {Full};
+		float average_us = 0;
+		uint_fast16_t frames_since_change = 0;
+};
+
+extern QualityGovernor governor;
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "snapshot.h"
+#include "backend.h"	// For FrameImage.
+
+
+// 1-bit alpha masks of every animation frame at every mip level, so clicks hit the sprite rather than its bounding box.
+// Each level is filtered like the pictures drawn from it, then thresholded. Rows are packed 64 pixels to a word,
+// so a point costs one word load and a small area one or two per row.
+class HitMasks {
+	public:
+		static const uint8_t AlphaThreshold = 128;	// Pixels at least this opaque can be hit.
+
+		void build(const vector<FrameImage> &frames);
+		bool empty() const {return masks[0].empty();}
+
+		// Whether any opaque pixel drawn for d is within tolerance of point (a square, not a circle).
+		bool hit(const DragonSnapshot &d, const Position &point, Distance tolerance = 0) const;
+
+	private:
+		typedef struct {
+			uint16_t width, height, words_per_row;
+			vector<uint64_t> bits;	// Bit x % 64 of word y * words_per_row + x / 64.
+		} Mask;
+
+		vector<Mask> masks[Animation::mip_levels];	// Indexed by level, then frame.
+
+		static bool any_set(const Mask &m, int x0, int y0, int x1, int y1);	// Inclusive, clipped to the mask.
+};
+
+
+// Topmost (last drawn) dragon with an opaque pixel within tolerance of point, or nullptr.
+// Bounding boxes are checked first, so masks are only read for dragons under the point.
+inline const DragonSnapshot *hit_test(const FrameSnapshot &snapshot, const Position &point, const HitMasks &masks, Distance tolerance = 0) {
+	for (auto d = snapshot.dragons.rbegin(); d != snapshot.dragons.rend(); d++) {
+		const Area reach = {
+			.origin = {d->origin.x - tolerance, d->origin.y - tolerance},
+			.width = d->width + 2 * tolerance,
+			.height = d->height + 2 * tolerance
+		};
+		if (!point_within_area(point, reach)) continue;
+		if (masks.empty() || masks.hit(*d, point, tolerance)) return &*d;
+	}
+	return nullptr;
+}
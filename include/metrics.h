@@ -0,0 +1,118 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+
+// All updates are relaxed atomics, so any thread can record without locking.
+
+class Counter {
+	public:
+		const char * const name, * const help;
+		Counter(const char *n, const char *h) : name(n), help(h) {}
+		void add(uint64_t n = 1) {value.fetch_add(n, memory_order_relaxed);}
+		uint64_t get() const {return value.load(memory_order_relaxed);}
+	private:
+		atomic<uint64_t> value {0};
+};
+
+class Gauge {
+	public:
+		const char * const name, * const help;
+		Gauge(const char *n, const char *h) : name(n), help(h) {}
+		void set(int64_t v) {value.store(v, memory_order_relaxed);}
+		int64_t get() const {return value.load(memory_order_relaxed);}
+	private:
+		atomic<int64_t> value {0};
+};
+
+// Durations in microseconds, bucketed logarithmically: four buckets per power of two, so within 25% of the true value.
+class Histogram {
+	public:
+		static const unsigned Buckets = 256;
+		const char * const name, * const help;
+		Histogram(const char *n, const char *h) : name(n), help(h) {}
+
+		void record(uint64_t us);
+		void record(chrono::steady_clock::duration d) {
+			record(chrono::duration_cast<chrono::microseconds>(d).count());
+		}
+
+		uint64_t count() const {return total.load(memory_order_relaxed);}
+		uint64_t sum() const {return total_us.load(memory_order_relaxed);}
+		uint64_t max() const {return largest.load(memory_order_relaxed);}
+		uint64_t bucket(unsigned i) const {return buckets[i].load(memory_order_relaxed);}
+		uint64_t percentile(double p) const;	// Upper bound of the bucket holding the pth percentile, p in [0,1].
+
+		static unsigned bucket_of(uint64_t us);
+		static uint64_t bucket_upper_bound(unsigned i);	// Exclusive.
+
+	private:
+		atomic<uint64_t> buckets[Buckets] = {};
+		atomic<uint64_t> total {0}, total_us {0}, largest {0};
+};
+
+
+class Metrics {
+	public:
+	Counter
+		spawned {"dragons_spawned_total", "Dragons spawned."},
+		killed {"dragons_killed_total", "Dragons killed by clicks."},
+		frames {"frames_rendered_total", "Frames drawn."},
+		x_requests {"x_requests_total", "Requests sent to the X server."},
+		round_trips {"x_round_trips_total", "Replies or checks waited on in the frame loop."},
+		sprite_uploads {"sprite_uploads_total", "Frames uploaded to the sprite atlas, including reloads after eviction."},
+		sprite_evictions {"sprite_evictions_total", "Frames evicted from the sprite atlas to stay within its budget."}
+	;
+	Gauge
+		alive {"dragons_alive", "Dragons in the last published frame."},
+		sparks {"sparks", "Kill sparks in the last drawn frame."},
+		quality_tier {"quality_tier", "Quality tier chosen by the frame-time governor. Zero is full quality."},
+		sprite_bytes {"sprite_bytes_resident", "Bytes of sprite pixels resident in the atlas on the X server."},
+		hidden {"hidden", "1 while paused because no window can be seen, else 0."}
+	;
+	Histogram
+		frame_time {"frame_seconds", "Time to draw a frame."},
+		move_time {"move_seconds", "Time to step the simulation for all dragons."},
+		kill_latency {"kill_latency_seconds", "Time from a click being received to the dragon being removed."},
+		present_latency {"kill_present_latency_seconds", "Time from a click being received to the first frame drawn without the dragon."}
+	;
+
+	const vector<Counter*> counters = {&spawned, &killed, &frames, &x_requests, &round_trips, &sprite_uploads, &sprite_evictions};
+	const vector<Gauge*> gauges = {&alive, &sparks, &quality_tier, &sprite_bytes, &hidden};
+	const vector<Histogram*> histograms = {&frame_time, &move_time, &kill_latency, &present_latency};
+
+	// Adds the requests sent since the last call, given the sequence number of the latest request.
+	void note_sequence(unsigned int sequence);
+
+	string prometheus() const;
+	string json() const;
+	void print_summary(FILE *out) const;
+
+	private:
+		atomic<unsigned int> last_sequence {0};
+};
+
+extern Metrics metrics;
+
+
+// Serves metrics on a Unix-domain socket: Prometheus text by default, JSON if the client first sends "json",
+// or an HTTP response if it sends a GET request.
+class MetricsServer {
+	public:
+		bool start(const char *path);
+		void stop();
+	private:
+		string path;
+		int listen_fd = -1;
+		int stop_pipe[2] = {-1, -1};
+		thread server_thread;
+		void serve();
+};
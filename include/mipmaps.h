@@ -0,0 +1,39 @@
+#pragma once
+
+#include "backend.h"	// For FrameImage.
+
+#include <string>
+
+
+// One level of a frame's mip chain. Points into memory owned by MipChains.
+typedef struct {
+	uint16_t width, height;
+	const uint8_t *bgra;
+} MipImage;
+
+
+// Box-filtered mip levels (1 and up) for every animation frame. Level 0 is the frame itself.
+// Filtered levels are kept between launches in a cache file, keyed by a hash of the frames and the filter parameters.
+// On a hit the file is mapped and its pixels are used in place, so nothing is filtered or copied.
+class MipChains {
+	public:
+		~MipChains();
+
+		// Pass an empty cache_dir to always filter. Returns false only if the levels could not be produced at all.
+		bool build(const vector<FrameImage> &frames, const string &cache_dir = default_cache_dir());
+		const MipImage &level(size_t frame, uint_fast8_t level) const {return levels[frame][level - 1];}
+		void release();		// Unmap or free the levels once they have been uploaded.
+
+		bool from_cache = false;
+
+		static string default_cache_dir();	// $XDG_CACHE_HOME/dragon-shooter, else ~/.cache/dragon-shooter. Empty if neither is set.
+
+	private:
+		vector<vector<MipImage>> levels;	// Indexed by frame, then level - 1.
+		vector<vector<uint8_t>> filtered;	// Backing for levels when they were filtered rather than mapped.
+		void *mapping = nullptr;
+		size_t mapping_size = 0;
+
+		bool map_cache(const string &path, const vector<FrameImage> &frames, uint64_t key);
+		void store_cache(const string &path, uint64_t key) const;
+};
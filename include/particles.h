@@ -0,0 +1,51 @@
+#pragma once
+
+#include "animation.h"	// For Fixed and Area.
+
+
+// A spark as drawn: a square, in window coordinates.
+typedef struct {
+	int16_t x, y;	// Top left.
+	uint8_t size;	// Width and height. Shrinks as the spark ages.
+} SparkSnapshot;
+
+// Premultiplied ARGB32 colour of every spark, so all of them can be drawn with one fill.
+static const uint32_t SparkColour = 0xe0e08c2a;
+
+
+// Sparks thrown out of killed dragons, stepped with the simulation.
+// Storage is allocated once and kept as one array per field, with live sparks packed at the front.
+// The rest of the arrays is the free pool: a spark is added at the end of the live ones, and an expired spark is
+// replaced by the last live one. When full, bursts are cut short rather than the arrays grown, so the cost of
+// stepping and drawing sparks is bounded however many dragons die at once.
+class ParticleSystem {
+	public:
+		static constexpr uint_fast16_t
+			DefaultCapacity = 4096,
+			BurstSize = 16		// Sparks per kill, while there is room.
+		;
+		// In pixels and base steps (see Animation::step_scale), like the dragons' speeds.
+		static constexpr uint_fast8_t
+			Lifetime = 6,
+			MaxSize = 4,
+			MaxLaunchSpeed = 12,
+			Gravity = 2		// Added to the downward speed every base step.
+		;
+
+		explicit ParticleSystem(size_t capacity = DefaultCapacity);
+
+		// Throws sparks out from random points in the area. Returns how many there was room for.
+		size_t burst(const Area &from, mt19937 &rng);
+		void step();	// Moves every spark by one simulation step, and frees those that have expired.
+		void snapshot(vector<SparkSnapshot> *out) const;	// Replaces out's contents.
+
+		size_t size() const {return live;}
+		size_t capacity() const {return x.size();}
+
+	private:
+		vector<Fixed> x, y, vx, vy;	// Centres, and speeds per base step.
+		vector<Fixed> age;		// In base steps.
+		size_t live = 0;
+
+		void free_spark(size_t i);
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "snapshot.h"
+#include "render.h"
+#include "atlas.h"
+
+#include <deque>
+#include <mutex>
+
+
+// Server-side pictures for every pool slot, kept by the X layer so the simulation never talks to the server.
+// Each slot has one picture per atlas page and orientation. Transforms are brought up to date when a slot is drawn,
+// from the scale recorded in its snapshot, and the frame is picked out of the page by the offset composited from.
+class DragonPictures {
+	public:
+		bool smooth = true;	// Filter for scaled pictures, applied to each slot's pictures as they are drawn. Render thread only.
+
+		typedef struct {
+			xcb_render_picture_t picture;	// XCB_NONE if there is nothing to draw.
+			int16_t x, y;			// Source (and mask) coordinates to composite from.
+		} Source;
+
+		void init(xcb_connection_t *c, xcb_render_pictformat_t f, SpriteAtlas *a);
+		size_t reserve(size_t slots);	// Add sets until there are at least this many slots. Pictures are created when first drawn.
+		void release();			// Frees all pictures. Call before disconnecting.
+
+		// Where to composite d from. Uploads its frame to the atlas if it was evicted.
+		Source source_for(const DragonSnapshot &d, uint_fast64_t frame_number);
+
+	private:
+		typedef struct {
+			xcb_render_picture_t picture;
+			float scale;	// Set in the transform. Zero when never set.
+			FixedPosition offset;	// Within a pixel, also set in the transform.
+			bool smooth;	// Set in the filter. The server starts with nearest.
+		} PagePicture;
+
+		typedef struct {
+			vector<PagePicture> pages[2];	// Indexed by orientation (natural first), then atlas page. Grown as pages are drawn from.
+		} PictureSet;
+
+		xcb_connection_t *conn = nullptr;
+		xcb_render_pictformat_t format;
+		SpriteAtlas *atlas = nullptr;
+
+		mutex m;	// Slots are added from the spawn thread while the render thread draws.
+		deque<PictureSet> sets;	// Indexed by slot. A deque, so adding sets never moves those in use.
+};
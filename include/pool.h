@@ -0,0 +1,25 @@
+#pragma once
+
+#include "animation.h"
+
+#include <memory>	// For unique_ptr.
+#include <mutex>
+
+
+// Recycles Animation instances, each numbered by its slot so the X layer can keep server-side pictures per slot.
+// Slots are created up front (or topped up from the spawn thread), so spawning and killing never allocate.
+class AnimationPool {
+	public:
+		size_t reserve(size_t total);	// Create slots until the pool owns at least total. Returns slots owned.
+		Animation *acquire();		// Returns nullptr when no free slot is available. Caller must reset() the instance.
+		void release(Animation * const a);
+		void clear();
+
+		size_t available();
+		size_t capacity();
+
+	private:
+		mutex m;
+		vector<unique_ptr<Animation>> slots;
+		vector<Animation*> free_slots;
+};
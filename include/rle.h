@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+
+// 32-bit sprite with its fully transparent spans left out. Each row is a list of spans of pixels, and everything
+// between them is transparent (zero). Dragon frames are mostly transparent, so this is a fraction of their full size,
+// and drawing can skip the gaps without reading them.
+class RleSprite {
+	public:
+		typedef struct {
+			uint16_t x, length;
+			uint32_t offset;	// Into the stored pixels.
+		} Span;
+
+		// Gaps narrower than this are stored as zero pixels inside a span, as a span costs about as much as this many.
+		static const uint16_t MinGap = 4;
+
+		uint16_t width = 0, height = 0;
+
+		// From 32-bit pixels with alpha in the top byte, e.g. BGRA bytes on a little-endian machine.
+		// Pixels with zero alpha are dropped whatever their colour, and decode as zero.
+		static RleSprite encode(uint16_t width, uint16_t height, const uint8_t *pixels);
+
+		const Span *spans_begin(uint16_t y) const {return spans.data() + row_start[y];}
+		const Span *spans_end(uint16_t y) const {return spans.data() + row_start[y + 1];}
+		const uint32_t *pixels_of(const Span &s) const {return pixels.data() + s.offset;}
+		// Columns [x0, x1) holding all of a row's spans. Returns false for a fully transparent row.
+		bool row_extent(uint16_t y, uint16_t *x0, uint16_t *x1) const;
+
+		// Writes the whole row (width pixels) to dst. If dst is already zero, pass cleared to only copy the spans.
+		void decode_row(uint16_t y, uint32_t *dst, bool cleared = false) const;
+
+		size_t bytes() const;	// Held on the heap.
+
+	private:
+		vector<uint32_t> row_start;	// Index of each row's first span, then one past the last span.
+		vector<Span> spans;
+		vector<uint32_t> pixels;
+};
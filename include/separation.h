@@ -0,0 +1,49 @@
+#pragma once
+
+#include "animation.h"
+
+
+// Broad phase for dragon-to-dragon separation.
+// Every update, dragons are bucketed into uniform grids by the top left corner of their (padded) areas. Each level's
+// cells are twice the size of the last, and a dragon goes in the first level with cells at least as large as it is,
+// so young and grown dragons are each only compared with those close enough to touch them.
+// The grids are rebuilt with a counting sort each update, so nothing is kept per dragon and killing one costs nothing.
+class SeparationGrid {
+	public:
+		// Dragons steer apart once their areas come within this many pixels of each other.
+		static const uint_fast8_t margin = 12;
+		static const uint_fast16_t BaseCell = 64;	// Size of the finest level's cells, in pixels.
+		static const uint_fast8_t Levels = 4;		// The coarsest level also takes anything larger than its cells.
+		// Pairs each dragon steers from per update. One push is half the separation limit, so a few already saturate it,
+		// and in a dense swarm this keeps the cost linear rather than growing with the number of neighbours.
+		static const uint_fast8_t MaxPushes = 8;
+
+		// Accumulate separation vectors for nearby pairs, up to MaxPushes for each dragon.
+		void update(const vector<Animation*> &dragons);
+
+		size_t pairs_last_update() const {return pair_count;}
+
+	private:
+		typedef struct {
+			Distance x0, y0, x1, y1;	// Padded area, edges included.
+		} Box;
+
+		typedef struct {
+			uint_fast32_t cell;		// Pixels per cell side.
+			Distance reach;			// Largest padded width or height of the dragons in this level.
+			uint_fast32_t cols, rows;
+			vector<uint32_t> starts;	// First entry of each cell in items, then one past the last.
+			vector<uint32_t> items;		// Dragon indices, grouped by cell.
+		} Grid;
+
+		Grid grids[Levels];
+		Position corner;	// Top left of every grid: the smallest padded corner of any dragon.
+		vector<Box> boxes;	// By dragon index.
+		vector<uint8_t> levels;	// Likewise.
+		vector<uint8_t> pushes;	// Likewise, this update.
+		vector<uint32_t> filled;	// Entries placed in each cell so far, while building.
+		size_t pair_count = 0;
+
+		void build(const vector<Animation*> &dragons);
+		uint_fast32_t cell_of(const Grid &g, Distance x, Distance y) const;
+};
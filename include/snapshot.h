@@ -0,0 +1,72 @@
+#pragma once
+
+#include "animation.h"
+#include "particles.h"
+
+
+// Everything needed to draw or hit-test one dragon, copied out of the simulation.
+typedef struct {
+	Animation *owner;		// Pooled, so it outlives the snapshot. Not to be read for kinematic state.
+	uint_fast32_t slot;		// Owner's pool slot, which selects its pictures in the X layer.
+	uint_fast32_t life;		// Owner's life when copied. Stops a stale snapshot killing a respawned dragon.
+	Position origin;
+	FixedPosition subpixel;		// How far right of and below origin the dragon really is, within a pixel.
+	Distance width, height;
+	float scale;
+	uint_fast16_t frame;		// Animation frame.
+	uint_fast8_t level;		// Mip level to draw from, with a residual scale of scale * 2^level.
+	Animation::X_orientation x_orient;
+} DragonSnapshot;
+
+typedef struct {
+	uint_fast64_t frame_number;
+	vector<DragonSnapshot> dragons;
+	vector<SparkSnapshot> sparks;	// Drawn over the dragons.
+} FrameSnapshot;
+
+inline DragonSnapshot snapshot_of(const Animation &a) {
+	return DragonSnapshot{
+		.owner = const_cast<Animation*>(&a),
+		.slot = a.slot,
+		.life = a.life(),
+		.origin = a.area.origin,
+		.subpixel = {fraction(a.position.x), fraction(a.position.y)},
+		.width = a.area.width,
+		.height = a.area.height,
+		.scale = a.scale,
+		.frame = a.frame_index(),
+		.level = a.level,
+		.x_orient = a.x_orient
+	};
+}
+
+
+// Lock-free single producer, single consumer triple buffer.
+// The producer fills back() and publishes it; the consumer picks up the most recently published buffer.
+// Neither side waits: publishing swaps the back buffer with the middle one, and update() swaps the middle with the front.
+template <typename T>
+class TripleBuffer {
+	public:
+		T &back() {return buffers[back_index];}
+		void publish() {
+			back_index = middle.exchange(back_index | Fresh) & IndexMask;
+		}
+
+		bool fresh() const {return middle.load() & Fresh;}
+		bool update() {	// Returns false if nothing new was published since the last update.
+			if (!fresh()) return false;
+			front_index = middle.exchange(front_index) & IndexMask;
+			return true;
+		}
+		const T &front() const {return buffers[front_index];}
+
+	private:
+		static const uint_fast8_t
+			IndexMask = 0b011,
+			Fresh = 0b100
+		;
+		T buffers[3];
+		uint_fast8_t back_index = 0;	// Only touched by the producer.
+		atomic<uint_fast8_t> middle {1};
+		uint_fast8_t front_index = 2;	// Only touched by the consumer.
+};
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+
+// Hierarchical timing wheel, advanced one tick per simulation step. Scheduling is constant time, and a tick only
+// touches the entries due in it, plus (once every Slots ticks) those cascading down from a coarser level.
+// Not thread-safe: schedule and advance from the thread that steps the simulation.
+template <typename T>
+class TimerWheel {
+	public:
+		static const unsigned
+			SlotBits = 6,
+			Slots = 1 << SlotBits,
+			Levels = 3
+		;
+		static const uint_fast64_t Horizon = (uint_fast64_t)1 << (SlotBits * Levels);	// In ticks. Longer delays are shortened to fit.
+
+		void schedule(uint_fast64_t ticks_from_now, T payload) {
+			// Never in the current tick, which may be firing.
+			if (ticks_from_now < 1) ticks_from_now = 1;
+			if (ticks_from_now >= Horizon) ticks_from_now = Horizon - 1;
+			place(Entry{tick + ticks_from_now, payload});
+			pending++;
+		}
+
+		// Moves to the next tick, calling fire(payload) for every entry due in it. fire may schedule more.
+		template <typename F>
+		void advance(F &&fire) {
+			tick++;
+			// Coarser levels first, so entries cascading from the top can land in the level below before it cascades.
+			for (unsigned level = Levels - 1; level > 0; level--) {
+				const uint_fast64_t span = (uint_fast64_t)1 << (SlotBits * level);
+				if (tick % span) continue;
+				auto &slot = slots[level][(tick >> (SlotBits * level)) % Slots];
+				cascading.swap(slot);
+				for (auto &e : cascading) place(e);
+				cascading.clear();
+			}
+			firing.swap(slots[0][tick % Slots]);
+			pending -= firing.size();
+			for (auto &e : firing) {
+				assert(e.due == tick);
+				fire(e.payload);
+			}
+			firing.clear();
+		}
+
+		uint_fast64_t now() const {return tick;}
+		size_t size() const {return pending;}
+
+	private:
+		typedef struct {
+			uint_fast64_t due;
+			T payload;
+		} Entry;
+
+		vector<Entry> slots[Levels][Slots];
+		vector<Entry> firing, cascading;	// Kept, so their capacity is reused.
+		uint_fast64_t tick = 0;
+		size_t pending = 0;
+
+		void place(const Entry &e) {
+			// The finest level whose range covers the delay. Its slot is visited again before the entry is due.
+			const uint_fast64_t delay = e.due - tick;
+			unsigned level = 0;
+			while (level + 1 < Levels && delay >= (uint_fast64_t)1 << (SlotBits * (level + 1))) level++;
+			slots[level][(e.due >> (SlotBits * level)) % Slots].push_back(e);
+		}
+};
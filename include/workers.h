@@ -0,0 +1,45 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>	// For unique_ptr.
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Fixed set of threads that run batches of indexed tasks.
+// Each participant owns a deque: it pops from the back of its own and steals from the front of the others,
+// so uneven chunks balance out without a shared queue becoming the bottleneck.
+class WorkStealingPool {
+	public:
+		explicit WorkStealingPool(unsigned threads = std::thread::hardware_concurrency());
+		~WorkStealingPool();
+
+		// Run task(i) for every i in [0, count) and return once all have finished. The calling thread takes part.
+		void run(size_t count, const std::function<void(size_t)> &task);
+
+		unsigned size() const {return queues.size();}	// Participants, including the calling thread.
+
+	private:
+		typedef struct {
+			std::mutex m;
+			std::deque<size_t> tasks;
+		} Queue;
+
+		std::vector<std::unique_ptr<Queue>> queues;	// Index 0 belongs to the thread calling run().
+		std::vector<std::thread> threads;
+
+		std::mutex m;
+		std::condition_variable wake, done;
+		const std::function<void(size_t)> *current = nullptr;
+		std::atomic<size_t> remaining {0};
+		uint_fast64_t generation = 0;
+		bool stopping = false;
+
+		void worker_loop(unsigned index);
+		void work(unsigned index);
+		bool take(unsigned index, size_t *task);
+};
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "backend.h"
+#include "pictures.h"
+#include "compositor.h"
+#include "mipmaps.h"
+
+
+// Composites each dragon on the server with XRender, from an atlas of mipmapped frames through pictures kept per pool slot.
+class XRenderBackend : public RenderBackend {
+	public:
+		// background is copied under the dragons every frame. Pass XCB_NONE to clear to transparent instead.
+		bool init(xcb_connection_t *c, xcb_window_t w, xcb_gcontext_t window_gc, xcb_render_pictformat_t f, uint16_t width, uint16_t height, xcb_drawable_t background);
+
+		string cache_dir = MipChains::default_cache_dir();	// For filtered mip levels. Empty to always filter.
+		size_t sprite_budget = 0;	// Bytes of atlas pages on the server. Zero for no limit.
+
+		bool upload_frames(const vector<FrameImage> &frames) override;
+		void reserve_slots(size_t slots) override;
+		void set_smooth_scaling(bool smooth) override {pictures.smooth = smooth;}
+
+		void begin_frame(uint_fast64_t frame_number) override;
+		void draw_sprite(const DragonSnapshot &d) override;
+		void draw_sparks(const vector<SparkSnapshot> &sparks) override;	// As one FillRectangles request.
+		void end_frame() override;
+
+		bool completes_on_server() const override {return true;}
+		void await_completion() override;
+
+		void release() override;
+
+	private:
+		xcb_connection_t *conn = nullptr;
+		xcb_window_t win;
+		xcb_gcontext_t gc;
+		uint16_t width, height;
+		xcb_drawable_t background;
+		xcb_render_picture_t target = 0;	// Of the window. Created once, rather than every frame.
+		SpriteAtlas atlas;
+		DragonPictures pictures;
+		uint_fast64_t frame_number = 0;	// Being drawn. Orders atlas entries for eviction.
+		vector<xcb_rectangle_t> spark_rects;	// Reused.
+		// Sent after each frame's requests. The server handles requests in order, so its reply means the frame is drawn.
+		xcb_get_input_focus_cookie_t completion;
+		bool awaiting = false;
+};
+
+
+// Blends on the client with SoftwareCompositor. Sprites are collected through the frame and blended together at the end.
+class SoftwareBackend : public RenderBackend {
+	public:
+		bool init(xcb_connection_t *c, xcb_window_t w, xcb_gcontext_t window_gc, uint16_t width, uint16_t height, xcb_drawable_t background);
+
+		string cache_dir = MipChains::default_cache_dir();	// For filtered mip levels. Empty to always filter.
+
+		bool upload_frames(const vector<FrameImage> &frames) override;
+		void invalidate(int16_t x, int16_t y, uint16_t width, uint16_t height) override;
+		void set_smooth_scaling(bool smooth) override {compositor.filter = smooth ? SoftwareCompositor::Bilinear : SoftwareCompositor::Nearest;}
+
+		void begin_frame(uint_fast64_t frame_number) override;
+		void draw_sprite(const DragonSnapshot &d) override;
+		void draw_sparks(const vector<SparkSnapshot> &sparks) override;
+		void end_frame() override;
+
+		void release() override;
+
+	private:
+		SoftwareCompositor compositor;
+		xcb_drawable_t background = XCB_NONE;
+		vector<xcb_rectangle_t> invalidated;	// Re-read from background at the start of the next frame.
+		FrameSnapshot frame;
+};
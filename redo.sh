@@ -1,10 +1,31 @@
 #!/bin/bash
 
+# The simulation core (src/core) has no X dependency. It is built once as a static library, shared by the game and the benchmark.
+mkdir -p build/core
+for src in ./src/core/*.cpp; do
+	g++ \
+		-frounding-math \
+		-ggdb -O0 \
+		-I include \
+		-c "$src" \
+		-o "build/core/$(basename "$src" .cpp).o" \
+	|| exit 1
+done
+ar rcs build/libdragon-core.a build/core/*.o
+
 g++ \
 	-frounding-math \
 	-ggdb -O0 \
-	-lxcb -lxcb-errors -lxcb-keysyms -lxcb-composite -lxcb-image -lxcb-render \
 	-I external/* -I include \
-	./src/* \
+	./src/*.cpp \
+	build/libdragon-core.a \
+	-lxcb -lxcb-errors -lxcb-keysyms -lxcb-composite -lxcb-image -lxcb-render -lxcb-shm -lxcb-shape -lxcb-damage -lxcb-sync -lxcb-screensaver \
 	-o dragon-shooter
 
+# Benchmarks are measured with optimisation, so the core is compiled again rather than linked from the debug library.
+g++ \
+	-frounding-math \
+	-O2 \
+	-I include \
+	./benchmarks/*.cpp ./src/core/*.cpp \
+	-o simulation-benchmark
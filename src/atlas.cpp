@@ -0,0 +1,202 @@
+#include "atlas.h"
+#include "metrics.h"
+#include "mipmaps.h"
+#include <xcb/xcb_image.h>
+#include <cstdio>	// For fprintf.
+#include <cstdlib>	// For free.
+
+
+void SpriteAtlas::init(xcb_connection_t *c, xcb_drawable_t d, xcb_gcontext_t g) {
+	conn = c;
+	drawable = d;
+	gc = g;
+}
+
+bool SpriteAtlas::load(const vector<FrameImage> &frames, const string &cache_dir) {
+	// Encoded copies are kept, so evicted frames can be uploaded again. The mip chains are only needed until then.
+	MipChains mips;
+	mips.build(frames, cache_dir);
+	for (uint_fast8_t l = 0; l < Animation::mip_levels; l++) {
+		sprites[l].clear();
+		sprites[l].reserve(frames.size());	// Entries point into these.
+		for (size_t f = 0; f < frames.size(); f++) {
+			if (l == 0) {
+				sprites[l].push_back(RleSprite::encode(frames[f].width, frames[f].height, frames[f].bgra.data()));
+			} else {
+				const MipImage &m = mips.level(f, l);
+				sprites[l].push_back(RleSprite::encode(m.width, m.height, m.bgra));
+			}
+		}
+	}
+	mips.release();
+
+	for (uint_fast8_t l = 0; l < Animation::mip_levels; l++) {
+		slot_width[l] = slot_height[l] = 0;
+		for (auto &sprite : sprites[l]) {
+			Entry e = {};
+			e.width = sprite.width;
+			e.height = sprite.height;
+			e.sprite = &sprite;
+			slot_width[l] = max<uint16_t>(slot_width[l], e.width + 2 * Gutter);
+			slot_height[l] = max<uint16_t>(slot_height[l], e.height + 2 * Gutter);
+			entries[l].push_back(e);
+		}
+	}
+
+	// Pages are square, and large enough for the largest entry.
+	page_width = max(PageSize, slot_width[0]);
+	page_height = max(PageSize, slot_height[0]);
+	const size_t page_bytes = (size_t)page_width * page_height * 4;
+	max_pages = budget ? max<size_t>(1, budget / page_bytes) : 0;
+	if (budget && budget < page_bytes) {
+		fprintf(stderr, "Warning: sprite budget is less than one atlas page (%zu KiB). Using one page.\n", page_bytes / 1024);
+	}
+
+	// Upload what fits without evicting, largest level first, so the first frames aren't held up.
+	for (uint_fast8_t l = 0; l < Animation::mip_levels; l++) for (auto &e : entries[l]) {
+		if (!allocate(slot_width[l], slot_height[l], &e.rect)) break;
+		upload(e);
+	}
+	return !pages.empty();
+}
+
+bool SpriteAtlas::add_page() {
+	if (max_pages && pages.size() >= max_pages) return false;
+	Page p = {.pixmap = xcb_generate_id(conn)};
+	xcb_generic_error_t *err;
+	if ((err = xcb_request_check(conn, xcb_create_pixmap_checked(conn,
+		32,		// Depth.
+		p.pixmap,
+		drawable,
+		page_width, page_height
+	)))) {
+		fprintf(stderr, "Failed to create atlas page.\n");
+		free(err);
+		return false;
+	}
+	pages.push_back(move(p));
+	return true;
+}
+
+bool SpriteAtlas::allocate(uint16_t width, uint16_t height, Rect *r) {
+	// First a rectangle freed by eviction, then room on a shelf, then a new shelf, then a new page.
+	// Of the freed rectangles, the smallest that fits is taken, so small entries don't break up slots larger ones could use.
+	Rect *best = nullptr;
+	for (auto &page : pages) for (auto &f : page.free) {
+		if (f.width < width || f.height < height) continue;
+		if (!best || (size_t)f.width * f.height < (size_t)best->width * best->height) best = &f;
+	}
+	if (best) {
+		// What is left over goes back on the free list: the rest of its row to the right, and everything below.
+		const Rect f = *best;
+		auto &freed = pages[f.page].free;
+		freed.erase(freed.begin() + (best - freed.data()));
+		*r = Rect{f.page, f.x, f.y, width, height};
+		if (f.width > width) freed.push_back(Rect{f.page, (int16_t)(f.x + width), f.y, (uint16_t)(f.width - width), height});
+		if (f.height > height) freed.push_back(Rect{f.page, f.x, (int16_t)(f.y + height), f.width, (uint16_t)(f.height - height)});
+		return true;
+	}
+	for (uint16_t p = 0; p < pages.size(); p++) {
+		Page &page = pages[p];
+		for (auto &shelf : page.shelves) {
+			if (shelf.height < height || shelf.used + width > page_width) continue;
+			*r = Rect{p, (int16_t)shelf.used, (int16_t)shelf.y, width, height};
+			shelf.used += width;
+			return true;
+		}
+		if (page.used + height <= page_height) {
+			page.shelves.push_back(Shelf{page.used, height, width});
+			*r = Rect{p, 0, (int16_t)page.used, width, height};
+			page.used += height;
+			return true;
+		}
+	}
+	if (!add_page()) return false;
+	return allocate(width, height, r);
+}
+
+bool SpriteAtlas::evict_least_recent(uint_fast64_t now) {
+	Entry *victim = nullptr;
+	for (auto &level : entries) for (auto &e : level) {
+		if (e.resident && (!victim || e.last_drawn < victim->last_drawn)) victim = &e;
+	}
+	if (!victim) return false;
+
+	victim->resident = false;
+	resident -= (size_t)victim->width * victim->height * 4;
+	Page &page = pages[victim->rect.page];
+	if (--page.entries) {
+		page.free.push_back(victim->rect);
+	} else {
+		// Nothing left on it, so shelves of any height can be laid out again.
+		page.shelves.clear();
+		page.free.clear();
+		page.used = 0;
+	}
+	metrics.sprite_evictions.add();
+	metrics.sprite_bytes.set(resident);
+	return true;
+}
+
+void SpriteAtlas::upload(Entry &e) {
+	// Padded with the cleared gutter, so nothing left over from an evicted entry shows around this one.
+	// Rows are decoded straight into it, and as it starts cleared only the visible spans are written.
+	padded.assign((size_t)e.rect.width * e.rect.height, 0);
+	for (uint16_t y = 0; y < e.height; y++) {
+		e.sprite->decode_row(y, padded.data() + (size_t)(y + Gutter) * e.rect.width + Gutter, true);
+	}
+	xcb_image_t *img = xcb_image_create_native(conn,
+		e.rect.width,			// Width.
+		e.rect.height,			// Height.
+		XCB_IMAGE_FORMAT_Z_PIXMAP,	// Format.
+		32,				// Depth.
+		NULL, 				// "base".
+		0,			 	// Data length (bytes).
+		NULL				// Data.
+	);
+	if (!img) return;
+	img->data = (uint8_t *)padded.data();	// Only read.
+	xcb_image_put(conn,
+		pages[e.rect.page].pixmap,
+		gc,
+		img,
+		e.rect.x, e.rect.y,
+		0
+	);
+	xcb_image_destroy(img);
+
+	e.resident = true;
+	e.placement = Placement{e.rect.page, (int16_t)(e.rect.x + Gutter), (int16_t)(e.rect.y + Gutter)};
+	pages[e.rect.page].entries++;
+	resident += (size_t)e.width * e.height * 4;
+	metrics.sprite_uploads.add();
+	metrics.sprite_bytes.set(resident);
+}
+
+const SpriteAtlas::Placement *SpriteAtlas::place(uint_fast16_t frame, uint_fast8_t level, uint_fast64_t now) {
+	if (level >= Animation::mip_levels || frame >= entries[level].size()) return nullptr;
+	Entry &e = entries[level][frame];
+	e.last_drawn = now;
+	if (e.resident) return &e.placement;
+
+	// Requests are handled in order, so an entry composited earlier in this frame can be overwritten safely.
+	while (!allocate(slot_width[level], slot_height[level], &e.rect)) {
+		if (!evict_least_recent(now)) return nullptr;
+	}
+	upload(e);
+	return &e.placement;
+}
+
+void SpriteAtlas::release() {
+	for (auto &p : pages) xcb_free_pixmap(conn, p.pixmap);
+	pages.clear();
+	for (auto &level : entries) level.clear();
+	for (auto &level : sprites) level.clear();
+	resident = 0;
+}
+
+size_t SpriteAtlas::client_bytes() const {
+	size_t bytes = 0;
+	for (auto &level : sprites) for (auto &sprite : level) bytes += sprite.bytes();
+	return bytes;
+}
@@ -0,0 +1,365 @@
+#include "background.h"
+#include "errors.h"
+#include <xcb/composite.h>
+#include <cstdio>
+#include <cstdlib>	// For free.
+#include <algorithm>
+
+
+extern xcb_generic_error_t *err;
+
+
+static bool intersect(const xcb_rectangle_t &a, const xcb_rectangle_t &b, xcb_rectangle_t *out) {
+	const int32_t
+		x0 = max<int32_t>(a.x, b.x),
+		y0 = max<int32_t>(a.y, b.y),
+		x1 = min<int32_t>(a.x + a.width, b.x + b.width),
+		y1 = min<int32_t>(a.y + a.height, b.y + b.height)
+	;
+	if (x0 >= x1 || y0 >= y1) return false;
+	if (out) *out = {(int16_t)x0, (int16_t)y0, (uint16_t)(x1 - x0), (uint16_t)(y1 - y0)};
+	return true;
+}
+
+
+bool LiveBackground::init(xcb_connection_t *c, xcb_connection_t *draw, xcb_screen_t *screen, xcb_pixmap_t target, xcb_render_pictformat_t target_format, vector<xcb_window_t> ignored_windows) {
+	conn = c;
+	draw_conn = draw;
+	root = screen->root;
+	ignored = ignored_windows;
+
+	const xcb_query_extension_reply_t *ext = xcb_get_extension_data(conn, &xcb_damage_id);
+	if (!ext || !ext->present) {
+		fprintf(stderr, "DAMAGE extension is not available.\n");
+		return false;
+	}
+	damage_event = ext->first_event + XCB_DAMAGE_NOTIFY;
+	auto *version = xcb_damage_query_version_reply(conn,
+		xcb_damage_query_version(conn, XCB_DAMAGE_MAJOR_VERSION, XCB_DAMAGE_MINOR_VERSION),
+		NULL
+	);
+	if (!version) {
+		fprintf(stderr, "Failed to query DAMAGE version.\n");
+		return false;
+	}
+	free(version);
+
+	// Keep contents of covered windows readable. Automatic redirection still has the server paint the screen itself.
+	if ((err = xcb_request_check(conn,
+		xcb_composite_redirect_subwindows_checked(conn, root, XCB_COMPOSITE_REDIRECT_AUTOMATIC)
+	))) {
+		fprintf(stderr, "Failed to redirect top-level windows.\n");
+		handle_error(conn, err);
+		return false;
+	}
+
+	{	// Map visuals to picture formats, for creating pictures on windows.
+		auto *fr = xcb_render_query_pict_formats_reply(conn, xcb_render_query_pict_formats(conn), NULL);
+		if (!fr) {
+			fprintf(stderr, "Failed to query picture formats.\n");
+			return false;
+		}
+		for (auto si = xcb_render_query_pict_formats_screens_iterator(fr); si.rem; xcb_render_pictscreen_next(&si)) {
+			for (auto di = xcb_render_pictscreen_depths_iterator(si.data); di.rem; xcb_render_pictdepth_next(&di)) {
+				for (auto vi = xcb_render_pictdepth_visuals_iterator(di.data); vi.rem; xcb_render_pictvisual_next(&vi)) {
+					visual_formats.push_back(*vi.data);
+				}
+			}
+		}
+		free(fr);
+	}
+
+	root_picture = xcb_generate_id(draw_conn);	// Clipped by children, so only the root background is read.
+	xcb_render_create_picture(draw_conn, root_picture, root, format_for_visual(screen->root_visual), 0, NULL);
+	target_picture = xcb_generate_id(draw_conn);
+	xcb_render_create_picture(draw_conn, target_picture, target, target_format, 0, NULL);
+
+	// Select before querying the tree, so no window is missed in between.
+	const uint32_t event_mask = XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY;
+	xcb_change_window_attributes(conn, root, XCB_CW_EVENT_MASK, &event_mask);
+
+	auto *tree = xcb_query_tree_reply(conn, xcb_query_tree(conn, root), NULL);
+	if (!tree) {
+		fprintf(stderr, "Failed to query top-level windows.\n");
+		release();
+		return false;
+	}
+	const xcb_window_t *children = xcb_query_tree_children(tree);
+	track(vector<xcb_window_t>(children, children + xcb_query_tree_children_length(tree)));	// Bottom first.
+	free(tree);
+
+	return true;
+}
+
+void LiveBackground::release() {
+	if (!conn) return;
+	{
+		lock_guard<mutex> lock(m);
+		for (auto &w : windows) {
+			xcb_damage_destroy(conn, w.damage);
+			xcb_render_free_picture(draw_conn, w.picture);
+		}
+		windows.clear();
+		pending.clear();
+	}
+	if (root_picture) xcb_render_free_picture(draw_conn, root_picture);
+	if (target_picture) xcb_render_free_picture(draw_conn, target_picture);
+	root_picture = target_picture = 0;
+	xcb_composite_unredirect_subwindows(conn, root, XCB_COMPOSITE_REDIRECT_AUTOMATIC);
+	const uint32_t event_mask = XCB_EVENT_MASK_NO_EVENT;
+	xcb_change_window_attributes(conn, root, XCB_CW_EVENT_MASK, &event_mask);
+	conn = nullptr;
+}
+
+
+vector<LiveBackground::Window>::iterator LiveBackground::find(xcb_window_t w) {
+	return find_if(windows.begin(), windows.end(), [w](const Window &tw) {return tw.window == w;});
+}
+
+void LiveBackground::track(const vector<xcb_window_t> &new_windows) {
+	// Issue every query before collecting any reply, so tracking costs one round trip.
+	vector<xcb_get_window_attributes_cookie_t> attribute_cookies;
+	vector<xcb_get_geometry_cookie_t> geometry_cookies;
+	for (auto w : new_windows) {
+		attribute_cookies.push_back(xcb_get_window_attributes(conn, w));
+		geometry_cookies.push_back(xcb_get_geometry(conn, w));
+	}
+
+	vector<Window> tracked;
+	for (size_t i = 0; i < new_windows.size(); i++) {
+		auto *attributes = xcb_get_window_attributes_reply(conn, attribute_cookies[i], NULL);
+		auto *geometry = xcb_get_geometry_reply(conn, geometry_cookies[i], NULL);
+		if (
+			attributes && geometry
+			&& attributes->_class != XCB_WINDOW_CLASS_INPUT_ONLY
+			&& std::find(ignored.begin(), ignored.end(), new_windows[i]) == ignored.end()
+		) {
+			Window w = {
+				.window = new_windows[i],
+				.damage = xcb_generate_id(conn),
+				.picture = xcb_generate_id(draw_conn),
+				.geometry = {	// Pictures start inside the border.
+					(int16_t)(geometry->x + geometry->border_width),
+					(int16_t)(geometry->y + geometry->border_width),
+					geometry->width,
+					geometry->height
+				},
+				.mapped = attributes->map_state == XCB_MAP_STATE_VIEWABLE
+			};
+			// Bounding box reports are enough, and each is cheap to acknowledge.
+			xcb_damage_create(conn, w.damage, w.window, XCB_DAMAGE_REPORT_LEVEL_BOUNDING_BOX);
+			const uint32_t subwindow_mode = XCB_SUBWINDOW_MODE_INCLUDE_INFERIORS;
+			// Created before the window is added under the lock, so refresh() only sends uses after it.
+			xcb_render_create_picture(draw_conn,
+				w.picture,
+				w.window,
+				format_for_visual(attributes->visual),
+				XCB_RENDER_CP_SUBWINDOW_MODE,
+				&subwindow_mode
+			);
+			tracked.push_back(w);
+		}
+		free(attributes);
+		free(geometry);
+	}
+
+	lock_guard<mutex> lock(m);
+	for (auto &w : tracked) {
+		windows.push_back(w);
+		if (w.mapped) damage(w.geometry);
+	}
+}
+
+void LiveBackground::untrack(vector<Window>::iterator w, bool destroyed) {
+	if (w->mapped) damage(w->geometry);
+	if (!destroyed) xcb_damage_destroy(conn, w->damage);	// Otherwise already destroyed with the window.
+	xcb_render_free_picture(draw_conn, w->picture);
+	windows.erase(w);
+}
+
+void LiveBackground::damage(const xcb_rectangle_t &r) {
+	// Merge with an overlapping rectangle, so repeated damage to one area doesn't pile up.
+	for (auto &p : pending) {
+		if (!intersect(p, r, nullptr)) continue;
+		const int32_t
+			x0 = min<int32_t>(p.x, r.x),
+			y0 = min<int32_t>(p.y, r.y),
+			x1 = max<int32_t>(p.x + p.width, r.x + r.width),
+			y1 = max<int32_t>(p.y + p.height, r.y + r.height)
+		;
+		p = {(int16_t)x0, (int16_t)y0, (uint16_t)(x1 - x0), (uint16_t)(y1 - y0)};
+		return;
+	}
+	pending.push_back(r);
+}
+
+void LiveBackground::restack(xcb_window_t window, xcb_window_t above) {
+	auto w = find(window);
+	if (w == windows.end()) return;
+	Window moved = *w;
+	windows.erase(w);
+	auto sibling = (above == XCB_NONE) ? windows.end() : find(above);
+	// No sibling means the bottom of the stack. An untracked sibling is treated as the top.
+	if (above == XCB_NONE) windows.insert(windows.begin(), moved);
+	else if (sibling == windows.end()) windows.push_back(moved);
+	else windows.insert(sibling + 1, moved);
+}
+
+xcb_render_pictformat_t LiveBackground::format_for_visual(xcb_visualid_t v) const {
+	for (auto &vf : visual_formats) if (vf.visual == v) return vf.format;
+	return 0;
+}
+
+
+bool LiveBackground::handle_event(const xcb_generic_event_t *gen_e) {
+	if (!conn) return false;
+	const uint8_t type = gen_e->response_type & ~0x80;
+
+	if (type == damage_event) {
+		auto *e = (const xcb_damage_notify_event_t *)gen_e;
+		xcb_damage_subtract(conn, e->damage, XCB_NONE, XCB_NONE);	// Re-arm reporting.
+		lock_guard<mutex> lock(m);
+		auto w = find(e->drawable);
+		if (w != windows.end() && w->mapped) {
+			damage(xcb_rectangle_t{
+				(int16_t)(w->geometry.x + e->area.x),
+				(int16_t)(w->geometry.y + e->area.y),
+				e->area.width,
+				e->area.height
+			});
+		}
+		return true;
+	}
+
+	switch (type) {
+		case XCB_CREATE_NOTIFY: {
+			auto *e = (const xcb_create_notify_event_t *)gen_e;
+			if (e->parent != root) return false;
+			track({e->window});
+			return true;
+		}
+		case XCB_DESTROY_NOTIFY: {
+			auto *e = (const xcb_destroy_notify_event_t *)gen_e;
+			if (e->event != root) return false;
+			lock_guard<mutex> lock(m);
+			auto w = find(e->window);
+			if (w != windows.end()) untrack(w, true);
+			return true;
+		}
+		case XCB_MAP_NOTIFY: {
+			auto *e = (const xcb_map_notify_event_t *)gen_e;
+			if (e->event != root) return false;
+			lock_guard<mutex> lock(m);
+			auto w = find(e->window);
+			if (w != windows.end()) {
+				w->mapped = true;
+				damage(w->geometry);
+			}
+			return true;
+		}
+		case XCB_UNMAP_NOTIFY: {
+			auto *e = (const xcb_unmap_notify_event_t *)gen_e;
+			if (e->event != root) return false;
+			lock_guard<mutex> lock(m);
+			auto w = find(e->window);
+			if (w != windows.end()) {
+				w->mapped = false;
+				damage(w->geometry);
+			}
+			return true;
+		}
+		case XCB_CONFIGURE_NOTIFY: {
+			auto *e = (const xcb_configure_notify_event_t *)gen_e;
+			if (e->event != root || e->window == root) return false;
+			lock_guard<mutex> lock(m);
+			auto w = find(e->window);
+			if (w == windows.end()) return true;
+			if (w->mapped) damage(w->geometry);	// Uncovered area.
+			w->geometry = {
+				(int16_t)(e->x + e->border_width),
+				(int16_t)(e->y + e->border_width),
+				e->width,
+				e->height
+			};
+			const bool mapped = w->mapped;
+			const xcb_rectangle_t geometry = w->geometry;
+			restack(e->window, e->above_sibling);	// Invalidates w.
+			if (mapped) damage(geometry);
+			return true;
+		}
+		case XCB_CIRCULATE_NOTIFY: {
+			auto *e = (const xcb_circulate_notify_event_t *)gen_e;
+			if (e->event != root) return false;
+			lock_guard<mutex> lock(m);
+			auto w = find(e->window);
+			if (w == windows.end()) return true;
+			if (w->mapped) damage(w->geometry);
+			if (e->place == XCB_PLACE_ON_TOP) restack(e->window, windows.back().window);
+			else restack(e->window, XCB_NONE);
+			return true;
+		}
+		case XCB_REPARENT_NOTIFY: {
+			auto *e = (const xcb_reparent_notify_event_t *)gen_e;
+			if (e->event != root) return false;
+			if (e->parent == root) {
+				track({e->window});
+			} else {
+				lock_guard<mutex> lock(m);
+				auto w = find(e->window);
+				if (w != windows.end()) untrack(w, false);
+			}
+			return true;
+		}
+	}
+	return false;
+}
+
+
+void LiveBackground::refresh(vector<xcb_rectangle_t> *refreshed) {
+	if (!conn) return;
+	lock_guard<mutex> lock(m);
+	uint32_t budget = RefreshBudgetPixels;
+	while (!pending.empty() && budget) {
+		xcb_rectangle_t &p = pending.back();
+		if (!p.width || !p.height) {
+			pending.pop_back();
+			continue;
+		}
+		// Take as many whole rows as the budget allows. The remainder waits for the next frame.
+		const uint16_t rows = min<uint32_t>(p.height, max<uint32_t>(1, budget / p.width));
+		const xcb_rectangle_t r = {p.x, p.y, p.width, rows};
+		budget -= min<uint32_t>(budget, (uint32_t)r.width * r.height);
+		if (rows == p.height) pending.pop_back();
+		else {
+			p.y += rows;
+			p.height -= rows;
+		}
+
+		// Root background first, then windows bottom to top.
+		xcb_render_composite(draw_conn,
+			XCB_RENDER_PICT_OP_SRC,
+			root_picture,
+			XCB_RENDER_PICTURE_NONE,
+			target_picture,
+			r.x, r.y,
+			0, 0,
+			r.x, r.y,
+			r.width, r.height
+		);
+		xcb_rectangle_t i;
+		for (auto &w : windows) {
+			if (!w.mapped || !intersect(w.geometry, r, &i)) continue;
+			xcb_render_composite(draw_conn,
+				XCB_RENDER_PICT_OP_OVER,
+				w.picture,
+				XCB_RENDER_PICTURE_NONE,
+				target_picture,
+				i.x - w.geometry.x, i.y - w.geometry.y,	// Source start coordinates, relative to the window.
+				0, 0,
+				i.x, i.y,
+				i.width, i.height
+			);
+		}
+		if (refreshed) refreshed->push_back(r);
+	}
+}
@@ -0,0 +1,458 @@
+#include "compositor.h"
+#include "errors.h"
+#include "metrics.h"
+#include <cstdio>
+#include <cstdlib>	// For free.
+#include <cstring>	// For memcpy.
+#include <algorithm>	// For clamp and sort.
+#include <sys/shm.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS
+#endif
+
+
+RleSprite make_sprite(uint16_t width, uint16_t height, const uint8_t *bgra) {
+	vector<uint32_t> premultiplied((size_t)width * height);
+	for (size_t i = 0; i < premultiplied.size(); i++) {
+		const uint8_t *p = &bgra[i * 4];
+		const uint32_t a = p[3];
+		// Premultiply. Bitmaps keep colour in fully transparent pixels, which "over" would otherwise add to the background.
+		premultiplied[i] =
+			(a << 24)
+			| ((p[2] * a + 127) / 255) << 16
+			| ((p[1] * a + 127) / 255) << 8
+			| ((p[0] * a + 127) / 255)
+		;
+	}
+	return RleSprite::encode(width, height, (const uint8_t *)premultiplied.data());
+}
+
+
+//
+// Premultiplied "over" kernels: dst = src + dst * (255 - src.alpha) / 255.
+//
+
+static inline uint32_t over(const uint32_t s, const uint32_t d) {
+	const uint32_t ia = 255 - (s >> 24);
+	// Two channels at a time. (x + 128 + ((x + 128) >> 8)) >> 8 divides by 255 with rounding.
+	uint32_t rb = (d & 0x00ff00ff) * ia + 0x00800080;
+	rb = ((rb + ((rb >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+	uint32_t ag = ((d >> 8) & 0x00ff00ff) * ia + 0x00800080;
+	ag = (ag + ((ag >> 8) & 0x00ff00ff)) & 0xff00ff00;
+	return s + (rb | ag);
+}
+
+static void blend_row_scalar(uint32_t *dst, const uint32_t *src, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		if (src[i] >> 24 == 0) continue;	// Premultiplied, so nothing to add.
+		dst[i] = src[i] >> 24 == 255 ? src[i] : over(src[i], dst[i]);
+	}
+}
+
+#ifdef HAVE_X86_KERNELS
+__attribute__((target("sse2")))
+static inline __m128i over_sse2(const __m128i s, const __m128i d) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i c255 = _mm_set1_epi16(255);
+	const __m128i c128 = _mm_set1_epi16(128);
+	__m128i result[2];
+	for (int half = 0; half < 2; half++) {
+		const __m128i s16 = half ? _mm_unpackhi_epi8(s, zero) : _mm_unpacklo_epi8(s, zero);
+		const __m128i d16 = half ? _mm_unpackhi_epi8(d, zero) : _mm_unpacklo_epi8(d, zero);
+		__m128i ia = _mm_shufflelo_epi16(s16, _MM_SHUFFLE(3,3,3,3));
+		ia = _mm_shufflehi_epi16(ia, _MM_SHUFFLE(3,3,3,3));
+		ia = _mm_sub_epi16(c255, ia);
+		__m128i t = _mm_add_epi16(_mm_mullo_epi16(d16, ia), c128);
+		t = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+		result[half] = t;
+	}
+	return _mm_adds_epu8(s, _mm_packus_epi16(result[0], result[1]));
+}
+__attribute__((target("sse2")))
+static void blend_row_sse2(uint32_t *dst, const uint32_t *src, size_t n) {
+	size_t i = 0;
+	for (; i + 4 <= n; i += 4) {
+		const __m128i s = _mm_loadu_si128((const __m128i *)&src[i]);
+		// Skip runs that are fully transparent, which is most of a dragon sprite.
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_srli_epi32(s, 24), _mm_setzero_si128())) == 0xffff) continue;
+		const __m128i d = _mm_loadu_si128((const __m128i *)&dst[i]);
+		_mm_storeu_si128((__m128i *)&dst[i], over_sse2(s, d));
+	}
+	blend_row_scalar(&dst[i], &src[i], n - i);
+}
+
+__attribute__((target("avx2")))
+static void blend_row_avx2(uint32_t *dst, const uint32_t *src, size_t n) {
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i c255 = _mm256_set1_epi16(255);
+	const __m256i c128 = _mm256_set1_epi16(128);
+	// Broadcasts each pixel's alpha byte across its four 16-bit channels.
+	const __m256i alpha_shuffle = _mm256_setr_epi8(
+		6, -1, 6, -1, 6, -1, 6, -1, 14, -1, 14, -1, 14, -1, 14, -1,
+		6, -1, 6, -1, 6, -1, 6, -1, 14, -1, 14, -1, 14, -1, 14, -1
+	);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		const __m256i s = _mm256_loadu_si256((const __m256i *)&src[i]);
+		if (_mm256_testz_si256(s, _mm256_set1_epi32(0xff000000))) continue;	// Fully transparent.
+		const __m256i d = _mm256_loadu_si256((const __m256i *)&dst[i]);
+		__m256i result[2];
+		for (int half = 0; half < 2; half++) {
+			const __m256i s16 = half ? _mm256_unpackhi_epi8(s, zero) : _mm256_unpacklo_epi8(s, zero);
+			const __m256i d16 = half ? _mm256_unpackhi_epi8(d, zero) : _mm256_unpacklo_epi8(d, zero);
+			const __m256i ia = _mm256_sub_epi16(c255, _mm256_shuffle_epi8(s16, alpha_shuffle));
+			__m256i t = _mm256_add_epi16(_mm256_mullo_epi16(d16, ia), c128);
+			t = _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+			result[half] = t;
+		}
+		// Unpack and pack both work within 128-bit lanes, so pixel order is preserved.
+		_mm256_storeu_si256((__m256i *)&dst[i], _mm256_adds_epu8(s, _mm256_packus_epi16(result[0], result[1])));
+	}
+	blend_row_sse2(&dst[i], &src[i], n - i);
+}
+#endif
+
+static void (*blend_row)(uint32_t *dst, const uint32_t *src, size_t n) = blend_row_scalar;
+
+
+// Linear interpolation of two premultiplied pixels, with f in [0,256).
+static inline uint32_t lerp(const uint32_t a, const uint32_t b, const uint32_t f) {
+	const uint32_t rb = ((((a & 0x00ff00ff) * (256 - f)) + ((b & 0x00ff00ff) * f)) >> 8) & 0x00ff00ff;
+	const uint32_t ag = ((((a >> 8) & 0x00ff00ff) * (256 - f)) + (((b >> 8) & 0x00ff00ff) * f)) & 0xff00ff00;
+	return rb | ag;
+}
+
+
+
+bool SoftwareCompositor::init(xcb_connection_t *c, xcb_drawable_t t, xcb_gcontext_t target_gc, uint16_t w, uint16_t h, xcb_drawable_t bg) {
+	conn = c;
+	target = t;
+	gc = target_gc;
+	width = w;
+	height = h;
+
+	auto *version = xcb_shm_query_version_reply(conn, xcb_shm_query_version(conn), NULL);
+	if (!version) {
+		fprintf(stderr, "MIT-SHM extension is not available.\n");
+		return false;
+	}
+	free(version);
+
+	const size_t bytes = (size_t)width * height * sizeof(uint32_t);
+	if ((shm_id = shmget(IPC_PRIVATE, bytes, IPC_CREAT | 0600)) < 0) {
+		perror("Failed to create shared memory segment");
+		return false;
+	}
+	void *address = shmat(shm_id, NULL, 0);
+	if (address == (void *)-1) {
+		perror("Failed to attach shared memory segment");
+		shmctl(shm_id, IPC_RMID, NULL);
+		shm_id = -1;
+		return false;
+	}
+	frame = (uint32_t *)address;
+
+	segment = xcb_generate_id(conn);
+	xcb_generic_error_t *err;
+	if ((err = xcb_request_check(conn, xcb_shm_attach_checked(conn, segment, shm_id, false)))) {
+		fprintf(stderr, "Failed to attach shared memory segment to server.\n");
+		handle_error(conn, err);
+		segment = 0;
+		shmctl(shm_id, IPC_RMID, NULL);
+		release();
+		return false;
+	}
+	shmctl(shm_id, IPC_RMID, NULL);	// Segment is destroyed once both sides have detached.
+
+	background.assign((size_t)width * height, 0);
+	if (bg != XCB_NONE) {
+		auto *reply = xcb_shm_get_image_reply(conn,
+			xcb_shm_get_image(conn,
+				bg,
+				0, 0,
+				width, height,
+				~0,				// Plane mask.
+				XCB_IMAGE_FORMAT_Z_PIXMAP,
+				segment,
+				0				// Offset.
+			),
+			&err
+		);
+		if (!reply) {
+			fprintf(stderr, "Failed to copy background. Using transparent background.\n");
+			if (err) handle_error(conn, err);
+		} else {
+			memcpy(background.data(), frame, bytes);
+			free(reply);
+		}
+	}
+	memcpy(frame, background.data(), bytes);
+
+#ifdef HAVE_X86_KERNELS
+	if (__builtin_cpu_supports("avx2")) blend_row = blend_row_avx2;
+	else if (__builtin_cpu_supports("sse2")) blend_row = blend_row_sse2;
+#endif
+	return true;
+}
+
+void SoftwareCompositor::release() {
+	if (last_put.sequence) {
+		metrics.round_trips.add();
+		xcb_generic_error_t *err;
+		if ((err = xcb_request_check(conn, last_put))) free(err);
+		last_put = {0};
+	}
+	if (segment) {
+		xcb_shm_detach(conn, segment);
+		xcb_flush(conn);
+		segment = 0;
+	}
+	if (frame) {
+		shmdt(frame);
+		frame = nullptr;
+	}
+	shm_id = -1;
+}
+
+
+bool SoftwareCompositor::clip(const DragonSnapshot &d, xcb_rectangle_t *r) const {
+	if (d.width <= 0 || d.height <= 0) return false;
+	const Distance
+		x0 = max<Distance>(d.origin.x, 0),
+		y0 = max<Distance>(d.origin.y, 0),
+		x1 = min<Distance>(d.origin.x + d.width, width),
+		y1 = min<Distance>(d.origin.y + d.height, height)
+	;
+	if (x0 >= x1 || y0 >= y1) return false;
+	*r = {(int16_t)x0, (int16_t)y0, (uint16_t)(x1 - x0), (uint16_t)(y1 - y0)};
+	return true;
+}
+
+void SoftwareCompositor::restore(const xcb_rectangle_t &r) {
+	for (uint16_t y = r.y; y < r.y + r.height; y++) {
+		const size_t offset = (size_t)y * width + r.x;
+		memcpy(&frame[offset], &background[offset], r.width * sizeof(uint32_t));
+	}
+}
+
+void SoftwareCompositor::blend(const DragonSnapshot &d, const xcb_rectangle_t &r) {
+	// From the snapshot's mip level, so only the residual scale is filtered here, as on the server.
+	const auto &level = sprites[min<uint_fast8_t>(d.level, Animation::mip_levels - 1)];
+	const RleSprite &sprite = level[d.frame % level.size()];
+	const bool flip = d.x_orient != Animation::natural_direction;
+	// Source distance per destination pixel, in 16.16 fixed point.
+	const uint32_t step_x = ((uint32_t)sprite.width << 16) / d.width;
+	const uint32_t step_y = ((uint32_t)sprite.height << 16) / d.height;
+	const bool unscaled = step_x == 1 << 16 && step_y == 1 << 16;
+	// Positions between pixels are only drawn when filtering, as nearest sampling would round them away again.
+	const Fixed
+		offset_x = filter == Nearest ? 0 : fixed_mul(d.subpixel.x, step_x),
+		offset_y = filter == Nearest ? 0 : fixed_mul(d.subpixel.y, step_y)
+	;
+	const bool aligned = unscaled && !offset_x && !offset_y;
+	const bool nearest = filter == Nearest || aligned;
+	const int32_t max_u = (sprite.width - 1) << 16, max_v = (sprite.height - 1) << 16;
+
+	if (aligned && !flip) {
+		// Each span is blended straight from the sprite, and the gaps between them are never touched.
+		for (uint16_t y = 0; y < r.height; y++) {
+			const uint16_t sy = r.y + y - d.origin.y;
+			uint32_t *dst = &frame[(size_t)(r.y + y) * width];
+			for (const RleSprite::Span *span = sprite.spans_begin(sy); span != sprite.spans_end(sy); span++) {
+				const int32_t
+					x0 = max<int32_t>(d.origin.x + span->x, r.x),
+					x1 = min<int32_t>(d.origin.x + span->x + span->length, r.x + r.width)
+				;
+				if (x0 < x1) blend_row(&dst[x0], sprite.pixels_of(*span) + (x0 - d.origin.x - span->x), x1 - x0);
+			}
+		}
+		return;
+	}
+
+	// Otherwise source rows are decoded as needed. Rows of opposite parity go in separate halves, so the two rows
+	// that bilinear filtering reads are held together, and each is decoded once for every destination row reading it.
+	decoded.resize(2 * (size_t)sprite.width);
+	int32_t decoded_row[2] = {-1, -1};
+	auto source_row = [&](uint32_t sy) {
+		uint32_t *dst = &decoded[(sy & 1) * (size_t)sprite.width];
+		if (decoded_row[sy & 1] != (int32_t)sy) {
+			sprite.decode_row(sy, dst);
+			decoded_row[sy & 1] = sy;
+		}
+		return (const uint32_t *)dst;
+	};
+
+	row.resize(r.width);
+	for (uint16_t y = 0; y < r.height; y++) {
+		const uint32_t dy = r.y + y - d.origin.y;
+		uint32_t sy0, sy1, fy = 0;
+		if (nearest) {
+			sy0 = sy1 = min<uint32_t>((dy * step_y) >> 16, sprite.height - 1);
+		} else {
+			// Sample at pixel centres.
+			const int32_t v = clamp<int32_t>(dy * step_y + step_y / 2 - 0x8000 - offset_y, 0, max_v);
+			sy0 = v >> 16;
+			sy1 = min<uint32_t>(sy0 + 1, sprite.height - 1);
+			fy = (v >> 8) & 0xff;
+		}
+
+		// Only columns that can sample a visible pixel are drawn. The bounds are widened a little for filtering.
+		uint16_t x0, x1, x0_below, x1_below;
+		const bool visible = sprite.row_extent(sy0, &x0, &x1), visible_below = sprite.row_extent(sy1, &x0_below, &x1_below);
+		if (!visible && !visible_below) continue;
+		if (!visible) {
+			x0 = x0_below;
+			x1 = x1_below;
+		} else if (visible_below) {
+			x0 = min(x0, x0_below);
+			x1 = max(x1, x1_below);
+		}
+		if (flip) {
+			const uint16_t mirrored_x0 = sprite.width - x1;
+			x1 = sprite.width - x0;
+			x0 = mirrored_x0;
+		}
+		const int32_t
+			first = max<int32_t>(r.x - d.origin.x, ((int64_t)x0 - 2) * 65536 / step_x),
+			last = min<int32_t>(r.x + r.width - d.origin.x, ((int64_t)x1 + 2) * 65536 / step_x + 1)
+		;
+		if (first >= last) continue;
+
+		const uint32_t *src0 = source_row(sy0), *src1 = source_row(sy1);
+		for (int32_t dx = first; dx < last; dx++) {
+			if (nearest) {
+				uint32_t sx = min<uint32_t>((dx * step_x) >> 16, sprite.width - 1);
+				if (flip) sx = sprite.width - 1 - sx;
+				row[dx - first] = src0[sx];
+			} else {
+				int32_t u = clamp<int32_t>(dx * step_x + step_x / 2 - 0x8000 - offset_x, 0, max_u);
+				if (flip) u = max_u - u;
+				const uint32_t sx0 = u >> 16, sx1 = min<uint32_t>(sx0 + 1, sprite.width - 1), fx = (u >> 8) & 0xff;
+				row[dx - first] = lerp(lerp(src0[sx0], src0[sx1], fx), lerp(src1[sx0], src1[sx1], fx), fy);
+			}
+		}
+		blend_row(&frame[(size_t)(r.y + y) * width + d.origin.x + first], row.data(), last - first);
+	}
+}
+
+
+void SoftwareCompositor::fill(const xcb_rectangle_t &r, uint32_t colour) {
+	row.assign(r.width, colour);
+	for (uint16_t y = r.y; y < r.y + r.height; y++) blend_row(&frame[(size_t)y * width + r.x], row.data(), r.width);
+}
+
+static inline DragonSnapshot area_of(const SparkSnapshot &s) {
+	return DragonSnapshot{.origin = {s.x, s.y}, .width = s.size, .height = s.size};
+}
+
+
+void SoftwareCompositor::update_background(xcb_drawable_t bg, const vector<xcb_rectangle_t> &rects) {
+	if (!frame) return;
+	// Issue every request before collecting any reply, so this costs one round trip.
+	vector<xcb_rectangle_t> clipped;
+	vector<xcb_get_image_cookie_t> cookies;
+	for (auto &r : rects) {
+		DragonSnapshot area = {.origin = {r.x, r.y}, .width = r.width, .height = r.height};
+		xcb_rectangle_t c;
+		if (!clip(area, &c)) continue;
+		clipped.push_back(c);
+		cookies.push_back(xcb_get_image(conn, XCB_IMAGE_FORMAT_Z_PIXMAP, bg, c.x, c.y, c.width, c.height, ~0));
+	}
+	if (!cookies.empty()) metrics.round_trips.add();	// Replies are pipelined, so only the first waits.
+	for (size_t i = 0; i < cookies.size(); i++) {
+		auto *reply = xcb_get_image_reply(conn, cookies[i], NULL);
+		if (!reply) continue;
+		const xcb_rectangle_t &c = clipped[i];
+		const uint32_t *data = (const uint32_t *)xcb_get_image_data(reply);	// 32-bit rows need no padding.
+		for (uint16_t y = 0; y < c.height; y++) {
+			memcpy(&background[(size_t)(c.y + y) * width + c.x], &data[(size_t)y * c.width], c.width * sizeof(uint32_t));
+		}
+		free(reply);
+		previous.push_back(c);	// Restored from the new background and pushed by the next draw().
+	}
+}
+
+void SoftwareCompositor::draw(const FrameSnapshot &snapshot) {
+	if (!frame || sprites[0].empty()) return;
+
+	// The server reads the frame asynchronously. Make sure the previous push has been processed before overwriting it.
+	if (last_put.sequence) {
+		metrics.round_trips.add();
+		xcb_generic_error_t *err;
+		if ((err = xcb_request_check(conn, last_put))) handle_error(conn, err);
+		last_put = {0};
+	}
+
+	current.clear();
+	xcb_rectangle_t r;
+	for (auto &d : snapshot.dragons) if (clip(d, &r)) current.push_back(r);
+	for (auto &s : snapshot.sparks) if (clip(area_of(s), &r)) current.push_back(r);
+
+	// Only areas drawn last frame or this frame differ from the background.
+	for (auto &p : previous) restore(p);
+	for (auto &c : current) restore(c);
+	for (auto &d : snapshot.dragons) if (clip(d, &r)) blend(d, r);
+	for (auto &s : snapshot.sparks) if (clip(area_of(s), &r)) fill(r, SparkColour);
+
+	push_damage();
+	swap(previous, current);
+}
+
+void SoftwareCompositor::push_damage() {
+	// Each rectangle is cut into the bands it covers, and spans overlapping in a band are merged, so dragons spread
+	// across the screen are pushed separately rather than as one box around them all.
+	damage.clear();
+	for (auto rects : {&previous, &current}) {
+		for (auto &r : *rects) {
+			const int32_t bottom = r.y + r.height;
+			for (int32_t band = r.y / BandHeight; band * BandHeight < bottom; band++) {
+				damage.push_back(Span{
+					(uint16_t)band,
+					r.x,
+					(int16_t)max<int32_t>(r.y, band * BandHeight),
+					(int16_t)(r.x + r.width),
+					(int16_t)min<int32_t>(bottom, (band + 1) * BandHeight)
+				});
+			}
+		}
+	}
+	sort(damage.begin(), damage.end(), [](const Span &a, const Span &b) {
+		return a.band != b.band ? a.band < b.band : a.x0 < b.x0;
+	});
+
+	size_t merged = 0;
+	for (size_t i = 1; i < damage.size(); i++) {
+		Span &m = damage[merged];
+		const Span &s = damage[i];
+		if (s.band == m.band && s.x0 <= m.x1) {
+			m.x1 = max(m.x1, s.x1);
+			m.y0 = min(m.y0, s.y0);
+			m.y1 = max(m.y1, s.y1);
+		} else {
+			damage[++merged] = s;
+		}
+	}
+	if (!damage.empty()) damage.resize(merged + 1);
+
+	// Requests are handled in order, so only the last is checked: once it is done, the server has read them all.
+	for (size_t i = 0; i < damage.size(); i++) {
+		const Span &s = damage[i];
+		const auto put = i + 1 < damage.size() ? xcb_shm_put_image : xcb_shm_put_image_checked;
+		const xcb_void_cookie_t cookie = put(conn,
+			target,
+			gc,
+			width, height,			// Dimensions of the whole frame in shared memory.
+			s.x0, s.y0,			// Source start coordinates.
+			s.x1 - s.x0, s.y1 - s.y0,	// Dimensions to copy.
+			s.x0, s.y0,			// Destination start coordinates.
+			32,				// Depth.
+			XCB_IMAGE_FORMAT_Z_PIXMAP,
+			false,				// Send completion event.
+			segment,
+			0				// Offset.
+		);
+		if (i + 1 == damage.size()) last_put = cookie;
+	}
+	if (!damage.empty()) xcb_flush(conn);
+}
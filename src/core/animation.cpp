@@ -1,12 +1,11 @@
 #include "animation.h"
-#include <cstdio>	// For fprintf.
+#include <cstdio>	// For printf.
 #include <cassert>
 
 
-extern xcb_connection_t *conn;
-extern xcb_void_cookie_t cookie;
-extern xcb_generic_error_t *err;
-extern xcb_render_pictforminfo_t pfi;
+Area win_area;
+const uint_fast8_t CursorEffectDistancePixels = 100;	// This is the area's apothem (because the math is simpler for a square than for a circle).
+Area cursor_effect_area;
 
 
 Position get_random_position(unsigned short x_max, unsigned short y_max) {
@@ -20,76 +19,38 @@ Position get_random_position(unsigned short x_max, unsigned short y_max) {
 Speed get_random_speed(short min, short max) {
 	static random_device rd;	// Obtain a random number from hardware.
 	static mt19937 gen(rd());	// Seed generator.
+	return get_random_speed(min, max, gen);
+}
+Speed get_random_speed(short min, short max, mt19937 &gen) {
 	uniform_int_distribution<short> distr(min, max);	// Define range.
-	return Speed{distr(gen), distr(gen)};
+	const short x = distr(gen);
+	return Speed{to_fixed(x), to_fixed(distr(gen))};
 }
 
 
-Animation::Animation() {
-	for (auto pixmap : pixmaps) {	// Cache pictures.
-		{	// For natural orientation:
-			auto pic = xcb_generate_id(conn);
-			xcb_render_create_picture_checked(conn,
-				pic,		// pid
-				pixmap,		// drawable
-				pfi.id,		// format
-				0,		// value_mask
-				NULL		// *value_list
-			);
-			if ((err = xcb_request_check(conn, cookie))) {
-				fprintf(stderr, "Failed to create background picture.\n");
-				continue;
-			}
-			nat_pics.push_back(pic);
-
-			if (min_scale) {
-				xcb_render_set_picture_transform(conn,
-					pic,
-					scale(Animation::min_scale)
-				);
-			}
-		}
+void Animation::reset(chrono::steady_clock::time_point now) {
+	born = now;
+	fully_mature = false;
+	state = (life() + 1) << 1;	// Alive, in a new life. Only the simulation thread resets, so nothing else changes life.
+	evasion_vector = {0, 0};
+	separation_vector = {0, 0};
 
-		{	// For unnatural orientation:
-			auto pic = xcb_generate_id(conn);
-			xcb_render_create_picture_checked(conn,
-				pic,		// pid
-				pixmap,		// drawable
-				pfi.id,		// format
-				0,		// value_mask
-				NULL		// *value_list
-			);
-			if ((err = xcb_request_check(conn, cookie))) {
-				fprintf(stderr, "Failed to create background picture.\n");
-				continue;
-			}
-			x_unat_pics.push_back(pic);
-
-			xcb_render_set_picture_transform(conn,
-				pic,
-				scale_flip_x(min_scale)
-			);
-		}
-	}
+	set_scale(min_scale);
 
 	area.origin = get_random_position(
 		// Subtracting scaled dimensions to ensure the entire animation is on screen.
 		win_area.width - area.width,
 		win_area.height - area.height
 	);
+	position = {to_fixed(area.origin.x), to_fixed(area.origin.y)};
 	recalculate_center();
 
 	speed = get_random_speed(-max_start_speed, max_start_speed);
 	x_orient = speed.x >= 0 ? Right : Left;
 	y_orient = speed.y >= 0 ? Down : Up;
 
-	pictures = x_orient == natural_direction ? &nat_pics : &x_unat_pics;
-	stage = pictures->begin();
-}
-
-Animation::~Animation() {
-	for (auto pic : nat_pics) xcb_render_free_picture(conn, pic);
-	for (auto pic : x_unat_pics) xcb_render_free_picture(conn, pic);
+	stage = 0;
+	stage_progress = 0;
 }
 
 
@@ -97,22 +58,13 @@ void Animation::reorient_x() {
 	// Set new orientation state and reset movement speed:
 	if (x_orient == Left) {
 		x_orient = Right;
-		speed.x = Animation::base_speed;
+		speed.x = to_fixed(Animation::base_speed);
 	} else {
 		x_orient = Left;
-		speed.x = 0 - Animation::base_speed;
+		speed.x = to_fixed(0 - Animation::base_speed);
 	}
-
-	unsigned short pos = stage - pictures->begin();
-
-	// Select pictures corresponding with the new orientation:
-	if (x_orient == natural_direction) pictures = &nat_pics;
-	else pictures = &x_unat_pics;
-
-	// Set current stage from the newly selected picture set:
-	stage = pictures->begin() + pos;
 }
-void Animation::move() {
+void Animation::move(mt19937 &rng, bool look_for_cursor) {
 	bool changed_direction_x = false;
 	bool changed_direction_y = false;
 
@@ -121,7 +73,7 @@ void Animation::move() {
 	//
 	{
 		// Currently assuming that cursor is always within the window area.
-		if (Speed vect = get_escape_vector(&cursor_effect_area)) {
+		if (Speed vect = look_for_cursor ? per_step(get_escape_vector(&cursor_effect_area)) : Speed{0, 0}) {
 			if (evasion_vector) {
 				// Already in evade mode. Update evasion_vector.
 
@@ -131,8 +83,8 @@ void Animation::move() {
 				if (signs_mismatch(vect.y, evasion_vector.y)) evasion_vector.y *= -1;
 
 				// Sum the vectors:
-				move_within_abs_limit(&evasion_vector.x, vect.x, max_evasion_distance);
-				move_within_abs_limit(&evasion_vector.y, vect.y, max_evasion_distance);
+				move_within_abs_limit(&evasion_vector.x, vect.x, to_fixed(max_evasion_distance));
+				move_within_abs_limit(&evasion_vector.y, vect.y, to_fixed(max_evasion_distance));
 			} else {
 				// Enter evade mode.
 				evasion_vector = vect;
@@ -155,7 +107,7 @@ void Animation::move() {
 					}
 				}
 				// Apply acceleration:
-				if (!changed_direction_x) move_within_abs_limit(&speed.x, vect.x, max_escape_speed);
+				if (!changed_direction_x) move_within_abs_limit(&speed.x, vect.x, to_fixed(max_escape_speed));
 			}
 			// Y-axis:
 			// Remember that X11's coordinate plane uses inverted Y-axis.
@@ -163,61 +115,88 @@ void Animation::move() {
 				if (vect.y > 0) {	// Evade by moving down.
 					if (y_orient == Up) {
 						y_orient = Down;
-						speed.y = Animation::base_speed;
+						speed.y = to_fixed(Animation::base_speed);
 						changed_direction_y = true;
 					}
 				} else {	// Evade by moving up.
 					if (y_orient == Down) {
 						y_orient = Up;
-						speed.y = 0 - Animation::base_speed;
+						speed.y = to_fixed(0 - Animation::base_speed);
 						changed_direction_y = true;
 					}
 
 				}
 				// Apply acceleration:
-				if (!changed_direction_y) move_within_abs_limit(&speed.y, vect.y, max_escape_speed);
+				if (!changed_direction_y) move_within_abs_limit(&speed.y, vect.y, to_fixed(max_escape_speed));
 			}
 			// Note: This does not print adjusted value when vect is only partially applied, due to speed limit.
 		} else if (evasion_vector) {
 			// Outside of cursor effect area, but still in evasion mode.
-			Speed accel = get_random_speed(min_accel, max_accel);
+			Speed accel = per_step(get_random_speed(min_accel, max_accel, rng));
 			// Reduce magnitude of each evasion_vector axis that is not zero toward 0.
 			// If an axis reaches or would have passed 0, evasion mode is concluded for that axis.
 			// Axes that have not concluded are accelerated with the max_escape_speed limit.
 			if (evasion_vector.x) {
-				move_toward_limit(&evasion_vector.x, max_accel, 0);
-				abs_move_within_limit(&speed.x, abs(accel.x), max_escape_speed);
+				move_toward_limit(&evasion_vector.x, per_step(to_fixed(max_accel)), 0);
+				abs_move_within_limit(&speed.x, abs(accel.x), to_fixed(max_escape_speed));
 			}
 			if (evasion_vector.y) {
-				move_toward_limit(&evasion_vector.y, max_accel, 0);
-				abs_move_within_limit(&speed.y, abs(accel.y), max_escape_speed);
+				move_toward_limit(&evasion_vector.y, per_step(to_fixed(max_accel)), 0);
+				abs_move_within_limit(&speed.y, abs(accel.y), to_fixed(max_escape_speed));
+			}
+		}
+	}
+
+	//
+	// Handle separation from other dragons (unless evading, which takes priority):
+	//
+	// Pushes along the current orientation accelerate (up to max_speed). Opposing pushes only decelerate,
+	// leaving reorientation to the acceleration logic below, so crowded dragons don't flip back and forth.
+	if (separation_vector && !evasion_vector) {
+		const Speed separation = per_step(separation_vector);
+		// X-axis:
+		if (separation_vector.x) {
+			if ((separation_vector.x > 0) == (x_orient == Right)) {
+				if (abs(speed.x) < to_fixed(max_speed)) move_within_abs_limit(&speed.x, separation.x, to_fixed(max_speed));
+			} else {
+				move_toward_limit(&speed.x, abs(separation.x), 0);
+			}
+		}
+		// Y-axis:
+		if (separation_vector.y) {
+			if ((separation_vector.y > 0) == (y_orient == Down)) {
+				if (abs(speed.y) < to_fixed(max_speed)) move_within_abs_limit(&speed.y, separation.y, to_fixed(max_speed));
+			} else {
+				move_toward_limit(&speed.y, abs(separation.y), 0);
 			}
 		}
 	}
+	separation_vector = {0, 0};
 
-	assert(abs(speed.x) <= max_escape_speed);
-	assert(abs(speed.y) <= max_escape_speed);
+	assert(abs(speed.x) <= to_fixed(max_escape_speed));
+	assert(abs(speed.y) <= to_fixed(max_escape_speed));
 
 	//
 	// Handle edge collision:
 	//
+	// Positions move in 16.16, so speeds below a pixel per step still add up.
 	// X-axis:
 	if (x_orient == Left) {
 		assert(speed.x <= 0);
 		if (
-			(area.origin.x += speed.x) < win_area.origin.x	// Hit left boundry.
+			(position.x += per_step(speed.x)) < to_fixed(win_area.origin.x)	// Hit left boundry.
 		) {
-			area.origin.x = win_area.origin.x;
+			position.x = to_fixed(win_area.origin.x);
 			reorient_x();
 			changed_direction_x = true;
 		}
 	} else {	// Going right.
 		assert(speed.x >= 0);
-		auto x_max = win_area.origin.x + win_area.width - area.width;
+		const Fixed x_max = to_fixed(win_area.origin.x + win_area.width - area.width);
 		if ( 
-			(area.origin.x += speed.x) > x_max		// Hit right boundry.
+			(position.x += per_step(speed.x)) > x_max		// Hit right boundry.
 		) {
-			area.origin.x = x_max;
+			position.x = x_max;
 			reorient_x();
 			changed_direction_x = true;
 		}
@@ -225,18 +204,18 @@ void Animation::move() {
 	// Y-axis:
 	if (y_orient == Up) {
 		assert(speed.y <= 0);
-		if ( (area.origin.y += speed.y) < win_area.origin.y) {	// Hit top boundry.
-			area.origin.y = win_area.origin.y;
-			speed.y = Animation::base_speed;	// X11 uses inverted Y-axis.
+		if ( (position.y += per_step(speed.y)) < to_fixed(win_area.origin.y)) {	// Hit top boundry.
+			position.y = to_fixed(win_area.origin.y);
+			speed.y = to_fixed(Animation::base_speed);	// X11 uses inverted Y-axis.
 			y_orient = Down;
 			changed_direction_y = true;
 		}
 	} else {	// Going down.
 		assert(speed.y >= 0);
-		auto y_max = win_area.origin.y + win_area.height - area.height;
-		if ( (area.origin.y += speed.y) > y_max ) {	// Hit bottom boundry.
-			area.origin.y = y_max;
-			speed.y = 0 - Animation::base_speed;	// X11 uses inverted Y-axis.
+		const Fixed y_max = to_fixed(win_area.origin.y + win_area.height - area.height);
+		if ( (position.y += per_step(speed.y)) > y_max ) {	// Hit bottom boundry.
+			position.y = y_max;
+			speed.y = to_fixed(0 - Animation::base_speed);	// X11 uses inverted Y-axis.
 			y_orient = Up;
 			changed_direction_y = true;
 		}
@@ -246,27 +225,27 @@ void Animation::move() {
 	// Handle acceleration (unless reset above or following evasion vector):
 	//
 	if (!(evasion_vector || changed_direction_x || changed_direction_y)) {
-		Speed accel = get_random_speed(min_accel, max_accel);
+		Speed accel = per_step(get_random_speed(min_accel, max_accel, rng));
 		// X-axis:
-		if (abs(speed.x) >= max_speed) {	// Reduce from max_escape_speed.
+		if (abs(speed.x) >= to_fixed(max_speed)) {	// Reduce from max_escape_speed.
 			move_toward_limit(&speed.x, accel.x, 0);
 		} else if (!changed_direction_x) {
 			if (speed.x == 0 && x_orient == Left) {
 				reorient_x();
 			} else {	// Do not accelerate when reorienting. Use base speed.
 				if (speed.x < 0) accel.x *= -1;
-				move_within_abs_limit(&speed.x, accel.x, max_speed);
+				move_within_abs_limit(&speed.x, accel.x, to_fixed(max_speed));
 			}
 		}
 		// Y-axis:
-		if (abs(speed.y) >= max_speed) {	// Reduce from max_escape_speed.
+		if (abs(speed.y) >= to_fixed(max_speed)) {	// Reduce from max_escape_speed.
 			move_toward_limit(&speed.y, accel.y, 0);
 		} else if (!changed_direction_y) {
 			if (speed.y == 0 && y_orient == Up) {
 				y_orient = Down;
 			} else {	// Do not accelerate when reorienting. Use base speed.
 				if (speed.y < 0) accel.y *= -1;
-				move_within_abs_limit(&speed.y, accel.y, max_speed);
+				move_within_abs_limit(&speed.y, accel.y, to_fixed(max_speed));
 			}
 		}
 	}
@@ -276,10 +255,8 @@ void Animation::move() {
 	assert(!(speed.y < 0 && y_orient == Down));
 
 
-	// Aging is handled near the end of movement, so the changed scale can't throw off other calculations.
-	if (!fully_mature) age();
-
-	// Recalculate center at the end, to account for movement and/or aging.
+	// Recalculate center at the end, to account for movement.
+	snap_origin();
 	recalculate_center();
 }
 Speed inline Animation::get_escape_vector(const Area * const a) {
@@ -289,11 +266,11 @@ Speed inline Animation::get_escape_vector(const Area * const a) {
 	// Awareness extends outward from animation instance's edges by the absolute value of its X or Y speed.
 	const Area awareness = {
 		.origin = {
-			.x = area.origin.x - abs(speed.x),
-			.y = area.origin.y - abs(speed.y)
+			.x = area.origin.x - whole(abs(speed.x)),
+			.y = area.origin.y - whole(abs(speed.y))
 		},
-		.width = area.width + (2*abs(speed.x)),
-		.height = area.height + (2*abs(speed.y)),
+		.width = area.width + (2*whole(abs(speed.x))),
+		.height = area.height + (2*whole(abs(speed.y))),
 		.center = area.center
 	};
 
@@ -348,16 +325,16 @@ Speed inline Animation::get_escape_vector(const Area * const a) {
 					// Break through vertically.
 					printf("Escape corner: break vertically.\n");
 					ret = {
-						(closer_side_x == Left ? accel_vector_reduced : -accel_vector_reduced),
-						(closer_side_y == Up ? accel_vector_boost : -accel_vector_boost)
+						to_fixed(closer_side_x == Left ? accel_vector_reduced : -accel_vector_reduced),
+						to_fixed(closer_side_y == Up ? accel_vector_boost : -accel_vector_boost)
 					};
 					return ret;
 				} else {
 					// Break through horizontally.
 					printf("Escape corner: break horizontally.\n");
 					ret = {
-						(closer_side_x == Left ? accel_vector_boost : -accel_vector_boost),
-						(closer_side_y == Up ? accel_vector_reduced : -accel_vector_reduced)
+						to_fixed(closer_side_x == Left ? accel_vector_boost : -accel_vector_boost),
+						to_fixed(closer_side_y == Up ? accel_vector_reduced : -accel_vector_reduced)
 					};
 					return ret;
 				}
@@ -368,13 +345,13 @@ Speed inline Animation::get_escape_vector(const Area * const a) {
 						printf("Escape edge: break vertically.\n");
 						if (y_orient == Down) {
 							ret = {
-								(closer_side_x == Left ? accel_vector_reduced : -accel_vector_reduced),
-								accel_vector_boost
+								to_fixed(closer_side_x == Left ? accel_vector_reduced : -accel_vector_reduced),
+								to_fixed(accel_vector_boost)
 							};
 						} else {	// y_orient == Up
 							ret = {
-								(closer_side_x == Left ? accel_vector_reduced : -accel_vector_reduced),
-								-accel_vector_boost
+								to_fixed(closer_side_x == Left ? accel_vector_reduced : -accel_vector_reduced),
+								to_fixed(-accel_vector_boost)
 							};
 						}
 						return ret;
@@ -384,13 +361,13 @@ Speed inline Animation::get_escape_vector(const Area * const a) {
 						printf("Escape edge: break horizontally.\n");
 						if (x_orient == Right) {
 							ret = {
-								accel_vector_boost,
-								(closer_side_y == Up ? accel_vector_reduced : -accel_vector_reduced)
+								to_fixed(accel_vector_boost),
+								to_fixed(closer_side_y == Up ? accel_vector_reduced : -accel_vector_reduced)
 							};
 						} else {	// x_orient == Left
 							ret = {
-								-accel_vector_boost,
-								(closer_side_y == Up ? accel_vector_reduced : -accel_vector_reduced)
+								to_fixed(-accel_vector_boost),
+								to_fixed(closer_side_y == Up ? accel_vector_reduced : -accel_vector_reduced)
 							};
 						}
 						return ret;
@@ -407,50 +384,62 @@ Speed inline Animation::get_escape_vector(const Area * const a) {
 	// Avoid reorientation while cursor is inside instance area.
 	// This protects against high frequency flipping and animations effectively getting stuck due to confusion.
 	if (point_within_area(cursor_effect_area.center, area) && speed) {
-		ret.x = x_orient == Right ? max_accel : -max_accel;
-		ret.y = y_orient == Down ? max_accel : -max_accel;
+		ret.x = to_fixed(x_orient == Right ? max_accel : -max_accel);
+		ret.y = to_fixed(y_orient == Down ? max_accel : -max_accel);
 		return ret;
 	}
 
 
+	// Rounded to whole units of acceleration, as an axis with any escape at all reorients the dragon.
 	ret = {
-		(Distance)round(escape_vector.x * max_accel),
-		(Distance)round(escape_vector.y * max_accel)
+		round_fixed(escape_vector.x * max_accel),
+		round_fixed(escape_vector.y * max_accel)
 	};
 	return ret;
 }
 
 
-void Animation::age() {
-	auto now = chrono::high_resolution_clock::now();
-	if ( (now - last_aged) < maturing_resolution ) {
-		return;
+void Animation::steer_away_from(const Area &other) {
+	Speed push;
+	if (area.center.x == other.center.x && area.center.y == other.center.y) {
+		// No heading between identical centers. Push along current orientation instead.
+		push = {
+			to_fixed(x_orient == Right ? max_accel : -max_accel),
+			to_fixed(y_orient == Down ? max_accel : -max_accel)
+		};
+	} else {
+		// Note that the source and destination are swapped, because we want to move away.
+		PreciseHeading heading = get_heading(area.center, other.center);
+		push = {
+			heading.x * max_accel,
+			heading.y * max_accel
+		};
 	}
+	move_within_abs_limit(&separation_vector.x, push.x, to_fixed(max_separation_accel));
+	move_within_abs_limit(&separation_vector.y, push.y, to_fixed(max_separation_accel));
+}
+
+
+void Animation::grow(chrono::steady_clock::time_point now) {
 	auto age = chrono::duration_cast<chrono::seconds>(now - born);
 	if (age >= max_maturity) {
 		fully_mature = true;
 	}
 	auto scale_value = (static_cast<float>(age.count()) / max_maturity.count()) * (max_scale - min_scale);
-	last_aged = now;
-	area.width = initial_width * scale_value;
-	area.height = initial_height * scale_value;
-	for (auto pic : nat_pics) {
-		xcb_render_set_picture_transform(conn,
-			pic,
-			scale(scale_value)
-		);
-	}
-	for (auto pic : x_unat_pics) {
-		xcb_render_set_picture_transform(conn,
-			pic,
-			scale_flip_x(scale_value)
-		);
-	}
+	set_scale(scale_value);
 
 	// Adjust position toward center of screen, so the new scale is entirely visible:
 	// This is redundant-- already handled in move(). Eliminate later.
 	auto x_max = win_area.origin.x + win_area.width - area.width;
-	if (area.origin.x > x_max) area.origin.x = x_max;
+	if (area.origin.x > x_max) position.x = to_fixed(x_max);
 	auto y_max = win_area.origin.y + win_area.height - area.height;
-	if (area.origin.y > y_max) area.origin.y = y_max;
+	if (area.origin.y > y_max) position.y = to_fixed(y_max);
+	snap_origin();
+}
+void Animation::set_scale(float s) {
+	// The renderer picks the level and residual scale up from snapshots.
+	area.width = initial_width * s;
+	area.height = initial_height * s;
+	level = level_for(s);
+	scale = s;
 }
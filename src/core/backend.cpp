@@ -0,0 +1,100 @@
+#include "backend.h"
+
+
+bool NullBackend::upload_frames(const vector<FrameImage> &frames) {
+	uploads += frames.size();
+	return true;
+}
+
+void NullBackend::print_summary(FILE *out) const {
+	fprintf(out, "Null backend: %lu frames uploaded, %lu frames with %lu sprites and %lu sparks drawn, %lu invalidations.\n",
+		(unsigned long)uploads, (unsigned long)frames, (unsigned long)sprites, (unsigned long)sparks, (unsigned long)invalidations
+	);
+}
+
+
+RecordingBackend::RecordingBackend(const char *path, unique_ptr<RenderBackend> n) : next(move(n)) {
+	static const size_t BufferSize = 1 << 20;
+	if (!(file = fopen(path, "w"))) {
+		perror("Failed to open render recording");
+		return;
+	}
+	buffer.resize(BufferSize);
+	setvbuf(file, buffer.data(), _IOFBF, buffer.size());
+}
+
+RecordingBackend::~RecordingBackend() {
+	if (file) fclose(file);
+}
+
+bool RecordingBackend::upload_frames(const vector<FrameImage> &frames) {
+	if (file) for (size_t i = 0; i < frames.size(); i++) {
+		fprintf(file, "upload %zu %u %u\n", i, frames[i].width, frames[i].height);
+		commands++;
+	}
+	return next ? next->upload_frames(frames) : true;
+}
+
+void RecordingBackend::reserve_slots(size_t slots) {
+	// Not recorded: this comes from the spawn thread, while the others come from the render thread.
+	if (next) next->reserve_slots(slots);
+}
+
+void RecordingBackend::invalidate(int16_t x, int16_t y, uint16_t width, uint16_t height) {
+	if (file) {
+		fprintf(file, "invalidate %d %d %u %u\n", x, y, width, height);
+		commands++;
+	}
+	if (next) next->invalidate(x, y, width, height);
+}
+
+void RecordingBackend::begin_frame(uint_fast64_t frame_number) {
+	if (file) {
+		fprintf(file, "begin %lu %ld\n",
+			(unsigned long)frame_number,
+			(long)chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - started).count()
+		);
+		commands++;
+	}
+	if (next) next->begin_frame(frame_number);
+}
+
+void RecordingBackend::draw_sprite(const DragonSnapshot &d) {
+	if (file) {
+		fprintf(file, "sprite %lu %lu %u %u %d %d %d %d %s\n",
+			(unsigned long)d.slot, (unsigned long)d.life,
+			(unsigned)d.frame, (unsigned)d.level,
+			(int)d.origin.x, (int)d.origin.y, (int)d.width, (int)d.height,
+			d.x_orient == Animation::Left ? "left" : "right"
+		);
+		commands++;
+	}
+	if (next) next->draw_sprite(d);
+}
+
+void RecordingBackend::draw_sparks(const vector<SparkSnapshot> &sparks) {
+	// Only counted: there can be thousands, and they say nothing about the dragons.
+	if (file && !sparks.empty()) {
+		fprintf(file, "sparks %zu\n", sparks.size());
+		commands++;
+	}
+	if (next) next->draw_sparks(sparks);
+}
+
+void RecordingBackend::end_frame() {
+	if (file) {
+		fputs("end\n", file);
+		commands++;
+	}
+	if (next) next->end_frame();
+}
+
+void RecordingBackend::release() {
+	if (file) fflush(file);
+	if (next) next->release();
+}
+
+void RecordingBackend::print_summary(FILE *out) const {
+	if (file) fprintf(out, "Recorded %lu render commands.\n", (unsigned long)commands);
+	if (next) next->print_summary(out);
+}
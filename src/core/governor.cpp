@@ -0,0 +1,24 @@
+#include "governor.h"
+
+
+QualityGovernor governor;
+
+
+QualityGovernor::Tier QualityGovernor::record(chrono::steady_clock::duration frame_time) {
+	if (!budget.count()) return Full;
+	const float us = chrono::duration<float, micro>(frame_time).count();
+	average_us += (us - average_us) * Smoothing;
+	if (frames_since_change < UINT_FAST16_MAX) frames_since_change++;
+
+	Tier t = tier();
+	if (average_us > budget.count() && frames_since_change >= SettleFrames && t + 1 < TierCount) {
+		t = (Tier)(t + 1);
+	} else if (average_us < budget.count() * Headroom && frames_since_change >= RecoverFrames && t > Full) {
+		t = (Tier)(t - 1);
+	} else {
+		return t;
+	}
+	frames_since_change = 0;
+	current.store(t, memory_order_relaxed);
+	return t;
+}
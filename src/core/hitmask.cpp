@@ -0,0 +1,84 @@
+#include "hitmask.h"
+
+
+static vector<uint8_t> alpha_halve(const vector<uint8_t> &src, uint16_t width, uint16_t height) {
+	// The alpha channel of box_filter_halve (mipmaps.cpp), so masks match the levels drawn.
+	const uint16_t half_width = max(1, width / 2), half_height = max(1, height / 2);
+	vector<uint8_t> dst((size_t)half_width * half_height);
+	for (uint16_t y = 0; y < half_height; y++) {
+		const uint8_t
+			*row0 = src.data() + (size_t)min(2 * y, height - 1) * width,
+			*row1 = src.data() + (size_t)min(2 * y + 1, height - 1) * width
+		;
+		for (uint16_t x = 0; x < half_width; x++) {
+			const size_t x0 = min(2 * x, width - 1), x1 = min(2 * x + 1, width - 1);
+			dst[(size_t)y * half_width + x] = (row0[x0] + row0[x1] + row1[x0] + row1[x1] + 2) / 4;
+		}
+	}
+	return dst;
+}
+
+
+void HitMasks::build(const vector<FrameImage> &frames) {
+	for (auto &level : masks) level.clear();
+	for (auto &frame : frames) {
+		vector<uint8_t> alpha((size_t)frame.width * frame.height);
+		for (size_t i = 0; i < alpha.size(); i++) alpha[i] = frame.bgra[i * 4 + 3];
+
+		uint16_t width = frame.width, height = frame.height;
+		for (uint_fast8_t l = 0; l < Animation::mip_levels; l++) {
+			if (l) {
+				alpha = alpha_halve(alpha, width, height);
+				width = max(1, width / 2);
+				height = max(1, height / 2);
+			}
+			Mask m = {width, height, (uint16_t)((width + 63) / 64)};
+			m.bits.resize((size_t)m.words_per_row * height);
+			for (uint16_t y = 0; y < height; y++) for (uint16_t x = 0; x < width; x++) {
+				if (alpha[(size_t)y * width + x] >= AlphaThreshold) m.bits[(size_t)y * m.words_per_row + x / 64] |= (uint64_t)1 << (x % 64);
+			}
+			masks[l].push_back(move(m));
+		}
+	}
+}
+
+bool HitMasks::any_set(const Mask &m, int x0, int y0, int x1, int y1) {
+	x0 = max(x0, 0);
+	y0 = max(y0, 0);
+	x1 = min(x1, m.width - 1);
+	y1 = min(y1, m.height - 1);
+	if (x0 > x1 || y0 > y1) return false;
+
+	const int first_word = x0 / 64, last_word = x1 / 64;
+	for (int y = y0; y <= y1; y++) {
+		const uint64_t *row = m.bits.data() + (size_t)y * m.words_per_row;
+		for (int w = first_word; w <= last_word; w++) {
+			// Bits from x0 in the first word, up to x1 in the last.
+			uint64_t bits = row[w];
+			if (w == first_word) bits &= ~(uint64_t)0 << (x0 % 64);
+			if (w == last_word) bits &= ~(uint64_t)0 >> (63 - x1 % 64);
+			if (bits) return true;
+		}
+	}
+	return false;
+}
+
+bool HitMasks::hit(const DragonSnapshot &d, const Position &point, Distance tolerance) const {
+	if (d.level >= Animation::mip_levels || d.frame >= masks[d.level].size()) return true;	// No mask, so fall back on the bounding box.
+	const Mask &m = masks[d.level][d.frame];
+
+	// Invert the picture transform: the level is drawn at the residual scale, and mirrored within the dragon's width.
+	const float residual = d.scale * (1 << d.level);
+	if (residual <= 0) return false;
+	float x0 = point.x - tolerance - d.origin.x, x1 = point.x + tolerance - d.origin.x;
+	if (d.x_orient != Animation::natural_direction) {
+		const float flipped0 = d.width - x1, flipped1 = d.width - x0;
+		x0 = flipped0;
+		x1 = flipped1;
+	}
+	const float
+		y0 = point.y - tolerance - d.origin.y,
+		y1 = point.y + tolerance - d.origin.y
+	;
+	return any_set(m, floorf(x0 / residual), floorf(y0 / residual), floorf(x1 / residual), floorf(y1 / residual));
+}
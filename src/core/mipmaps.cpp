@@ -0,0 +1,207 @@
+#include "mipmaps.h"
+#include "animation.h"	// For mip_levels.
+
+#include <cstdio>
+#include <cstdlib>	// For getenv.
+#include <cstring>	// For memcmp.
+#include <filesystem>
+#include <fcntl.h>	// For open.
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>	// For close and getpid.
+
+
+// Bump whenever the filter or the file layout changes, so old files are ignored rather than misread.
+static const uint32_t CacheVersion = 1;
+static const char CacheMagic[8] = "DSMIPS";
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t frame_count;
+	uint32_t levels;	// Per frame, not counting level 0.
+	uint32_t reserved;
+	uint64_t key;
+} CacheHeader;
+// Followed by, for each frame then each level: uint16_t width, uint16_t height, then width * height * 4 bytes of BGRA.
+static const size_t LevelHeaderSize = 2 * sizeof(uint16_t);
+
+
+static vector<uint8_t> box_filter_halve(const uint8_t *src, uint16_t width, uint16_t height) {
+	// Averages 2x2 blocks of 32-bit pixels, channel by channel. An odd last row or column is averaged with itself.
+	const uint16_t half_width = max(1, width / 2), half_height = max(1, height / 2);
+	vector<uint8_t> dst((size_t)half_width * half_height * 4);
+	for (uint16_t y = 0; y < half_height; y++) {
+		const uint8_t
+			*row0 = src + (size_t)min(2 * y, height - 1) * width * 4,
+			*row1 = src + (size_t)min(2 * y + 1, height - 1) * width * 4
+		;
+		for (uint16_t x = 0; x < half_width; x++) {
+			const size_t x0 = min(2 * x, width - 1) * 4, x1 = min(2 * x + 1, width - 1) * 4;
+			for (uint_fast8_t c = 0; c < 4; c++) {
+				dst[((size_t)y * half_width + x) * 4 + c] = (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) / 4;
+			}
+		}
+	}
+	return dst;
+}
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t size) {
+	const uint8_t *bytes = (const uint8_t*)data;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3;
+	}
+	return hash;
+}
+
+static uint64_t cache_key(const vector<FrameImage> &frames) {
+	// Everything the filtered levels depend on.
+	uint64_t hash = 0xcbf29ce484222325;
+	const uint32_t params[] = {CacheVersion, (uint32_t)Animation::mip_levels, (uint32_t)frames.size()};
+	hash = fnv1a(hash, params, sizeof(params));
+	for (auto &frame : frames) {
+		hash = fnv1a(hash, &frame.width, sizeof(frame.width));
+		hash = fnv1a(hash, &frame.height, sizeof(frame.height));
+		hash = fnv1a(hash, frame.bgra.data(), frame.bgra.size());
+	}
+	return hash;
+}
+
+
+MipChains::~MipChains() {
+	release();
+}
+
+string MipChains::default_cache_dir() {
+	if (const char *xdg = getenv("XDG_CACHE_HOME"); xdg && *xdg) return string(xdg) + "/dragon-shooter";
+	if (const char *home = getenv("HOME"); home && *home) return string(home) + "/.cache/dragon-shooter";
+	return "";
+}
+
+bool MipChains::build(const vector<FrameImage> &frames, const string &cache_dir) {
+	release();
+	const uint64_t key = cache_key(frames);
+	string path;
+	if (!cache_dir.empty()) {
+		char name[40];
+		snprintf(name, sizeof(name), "/mipmaps-%016llx.bin", (unsigned long long)key);
+		path = cache_dir + name;
+		if ((from_cache = map_cache(path, frames, key))) return true;
+	}
+
+	// Each level is filtered from the one above it, so every source pixel contributes.
+	levels.resize(frames.size());
+	filtered.reserve(frames.size() * (Animation::mip_levels - 1));
+	for (size_t f = 0; f < frames.size(); f++) {
+		const uint8_t *above = frames[f].bgra.data();
+		uint16_t width = frames[f].width, height = frames[f].height;
+		for (uint_fast8_t l = 1; l < Animation::mip_levels; l++) {
+			filtered.push_back(box_filter_halve(above, width, height));
+			width = max(1, width / 2);
+			height = max(1, height / 2);
+			above = filtered.back().data();
+			levels[f].push_back(MipImage{width, height, above});
+		}
+	}
+
+	if (!path.empty()) store_cache(path, key);
+	return true;
+}
+
+bool MipChains::map_cache(const string &path, const vector<FrameImage> &frames, uint64_t key) {
+	const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return false;	// Not cached yet.
+	struct stat st;
+	if (fstat(fd, &st) || (size_t)st.st_size < sizeof(CacheHeader)) {
+		close(fd);
+		return false;
+	}
+	void *m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);	// The mapping stays valid.
+	if (m == MAP_FAILED) return false;
+	mapping = m;
+	mapping_size = st.st_size;
+
+	// The key is in the file name, but the contents are still checked in case the file was cut short, renamed,
+	// or is from another version. Level sizes are checked against the frames too, so they can be trusted when uploading.
+	const uint8_t *p = (const uint8_t*)mapping, *end = p + mapping_size;
+	const CacheHeader *header = (const CacheHeader*)p;
+	if (
+		memcmp(header->magic, CacheMagic, sizeof(CacheMagic))
+		|| header->version != CacheVersion
+		|| header->key != key
+		|| header->frame_count != frames.size()
+		|| header->levels != Animation::mip_levels - 1u
+	) {
+		release();
+		return false;
+	}
+	p += sizeof(CacheHeader);
+	levels.resize(frames.size());
+	for (size_t f = 0; f < frames.size(); f++) {
+		uint16_t width = frames[f].width, height = frames[f].height;
+		for (uint_fast8_t l = 1; l < Animation::mip_levels; l++) {
+			if ((size_t)(end - p) < LevelHeaderSize) {
+				release();
+				return false;
+			}
+			uint16_t size[2];
+			memcpy(size, p, LevelHeaderSize);
+			p += LevelHeaderSize;
+			width = max(1, width / 2);	// As filtered by build().
+			height = max(1, height / 2);
+			if (size[0] != width || size[1] != height) {
+				release();
+				return false;
+			}
+			const size_t bytes = (size_t)size[0] * size[1] * 4;
+			if ((size_t)(end - p) < bytes) {
+				release();
+				return false;
+			}
+			levels[f].push_back(MipImage{size[0], size[1], p});
+			p += bytes;
+		}
+	}
+	return true;
+}
+
+void MipChains::store_cache(const string &path, uint64_t key) const {
+	// Written under a temporary name and renamed, so other instances never map a partial file.
+	error_code ec;
+	filesystem::create_directories(filesystem::path(path).parent_path(), ec);
+	const string temporary = path + ".tmp" + to_string(getpid());
+	FILE *file = fopen(temporary.c_str(), "wb");
+	if (!file) {
+		fprintf(stderr, "Warning: could not write mipmap cache \"%s\".\n", temporary.c_str());
+		return;
+	}
+	CacheHeader header = {};
+	memcpy(header.magic, CacheMagic, sizeof(CacheMagic));
+	header.version = CacheVersion;
+	header.frame_count = levels.size();
+	header.levels = Animation::mip_levels - 1;
+	header.key = key;
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+	for (auto &frame : levels) for (auto &level : frame) {
+		const uint16_t size[2] = {level.width, level.height};
+		written = written
+			&& fwrite(size, LevelHeaderSize, 1, file) == 1
+			&& fwrite(level.bgra, (size_t)level.width * level.height * 4, 1, file) == 1
+		;
+	}
+	if (fclose(file) || !written || rename(temporary.c_str(), path.c_str())) {
+		fprintf(stderr, "Warning: could not write mipmap cache \"%s\".\n", path.c_str());
+		remove(temporary.c_str());
+	}
+}
+
+void MipChains::release() {
+	if (mapping) munmap(mapping, mapping_size);
+	mapping = nullptr;
+	mapping_size = 0;
+	levels.clear();
+	filtered.clear();
+	from_cache = false;
+}
@@ -0,0 +1,68 @@
+#include "particles.h"
+
+
+ParticleSystem::ParticleSystem(size_t capacity) :
+	x(capacity),
+	y(capacity),
+	vx(capacity),
+	vy(capacity),
+	age(capacity)
+{}
+
+size_t ParticleSystem::burst(const Area &from, mt19937 &rng) {
+	const size_t count = min<size_t>(BurstSize, capacity() - live);
+	if (!count || from.width <= 0 || from.height <= 0) return 0;
+	uniform_int_distribution<Distance>
+		across(from.origin.x, from.origin.x + from.width - 1),
+		down(from.origin.y, from.origin.y + from.height - 1)
+	;
+	// Launch speeds are drawn in 16.16 directly, so sparks spread smoothly rather than in whole pixels.
+	uniform_int_distribution<Fixed> launch(-to_fixed(MaxLaunchSpeed), to_fixed(MaxLaunchSpeed));
+	for (size_t i = live; i < live + count; i++) {
+		x[i] = to_fixed(across(rng));
+		y[i] = to_fixed(down(rng));
+		vx[i] = launch(rng);
+		vy[i] = launch(rng) - to_fixed(MaxLaunchSpeed / 2);	// Mostly upward, before gravity takes over.
+		age[i] = 0;
+	}
+	live += count;
+	return count;
+}
+
+void ParticleSystem::free_spark(size_t i) {
+	// Order doesn't matter, so the last live spark fills the gap.
+	live--;
+	x[i] = x[live];
+	y[i] = y[live];
+	vx[i] = vx[live];
+	vy[i] = vy[live];
+	age[i] = age[live];
+}
+
+void ParticleSystem::step() {
+	const Fixed
+		fall = Animation::per_step(to_fixed(Gravity)),
+		expiry = to_fixed(Lifetime)
+	;
+	// Each array is walked in order on its own, so a step streams through memory.
+	for (size_t i = 0; i < live; i++) x[i] += Animation::per_step(vx[i]);
+	for (size_t i = 0; i < live; i++) y[i] += Animation::per_step(vy[i]);
+	for (size_t i = 0; i < live; i++) vy[i] += fall;
+	for (size_t i = 0; i < live; i++) age[i] += Animation::step_scale;
+	for (size_t i = 0; i < live;) {
+		if (age[i] >= expiry) free_spark(i);	// Check the spark moved here next.
+		else i++;
+	}
+}
+
+void ParticleSystem::snapshot(vector<SparkSnapshot> *out) const {
+	out->resize(live);	// Keeps capacity.
+	for (size_t i = 0; i < live; i++) {
+		const uint8_t size = MaxSize - (uint_fast32_t)age[i] * MaxSize / to_fixed(Lifetime);
+		(*out)[i] = SparkSnapshot{
+			(int16_t)(whole(x[i]) - size / 2),
+			(int16_t)(whole(y[i]) - size / 2),
+			size
+		};
+	}
+}
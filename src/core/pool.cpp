@@ -0,0 +1,46 @@
+#include "pool.h"
+
+
+size_t AnimationPool::reserve(size_t total) {
+	lock_guard<mutex> lock(m);
+	if (slots.size() >= total) return slots.size();
+	free_slots.reserve(total);
+	slots.reserve(total);
+	while (slots.size() < total) {
+		Animation *a = new Animation();
+		a->slot = slots.size();
+		free_slots.push_back(a);
+		slots.emplace_back(a);
+	}
+	return slots.size();
+}
+
+Animation *AnimationPool::acquire() {
+	lock_guard<mutex> lock(m);
+	if (free_slots.empty()) return nullptr;
+	Animation *a = free_slots.back();
+	free_slots.pop_back();
+	return a;
+}
+
+void AnimationPool::release(Animation * const a) {
+	lock_guard<mutex> lock(m);
+	free_slots.push_back(a);	// Never reallocates: reserve() sized it for every slot.
+}
+
+void AnimationPool::clear() {
+	lock_guard<mutex> lock(m);
+	free_slots.clear();
+	slots.clear();
+}
+
+
+size_t AnimationPool::available() {
+	lock_guard<mutex> lock(m);
+	return free_slots.size();
+}
+
+size_t AnimationPool::capacity() {
+	lock_guard<mutex> lock(m);
+	return slots.size();
+}
@@ -0,0 +1,76 @@
+#include "rle.h"
+
+#include <cstring>	// For memcpy and memset.
+
+
+static inline uint32_t load_pixel(const uint8_t *p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));	// Mapped mip levels are only byte aligned as far as the compiler knows.
+	return v;
+}
+
+
+RleSprite RleSprite::encode(uint16_t width, uint16_t height, const uint8_t *source) {
+	RleSprite sprite;
+	sprite.width = width;
+	sprite.height = height;
+	sprite.row_start.reserve(height + 1);
+	for (uint16_t y = 0; y < height; y++) {
+		sprite.row_start.push_back(sprite.spans.size());
+		const uint8_t *row = source + (size_t)y * width * 4;
+		uint16_t x = 0;
+		while (x < width) {
+			// Find the next visible pixel, then extend the span until a gap at least MinGap wide.
+			while (x < width && !(load_pixel(row + x * 4) >> 24)) x++;
+			if (x == width) break;
+			const uint16_t start = x;
+			uint16_t end = x, gap = 0;
+			for (; x < width && gap < MinGap; x++) {
+				if (load_pixel(row + x * 4) >> 24) {
+					end = x + 1;
+					gap = 0;
+				} else {
+					gap++;
+				}
+			}
+			x = end;
+			sprite.spans.push_back(Span{start, (uint16_t)(end - start), (uint32_t)sprite.pixels.size()});
+			for (uint16_t i = start; i < end; i++) {
+				const uint32_t p = load_pixel(row + i * 4);
+				sprite.pixels.push_back(p >> 24 ? p : 0);
+			}
+		}
+	}
+	sprite.row_start.push_back(sprite.spans.size());
+	sprite.spans.shrink_to_fit();
+	sprite.pixels.shrink_to_fit();
+	return sprite;
+}
+
+bool RleSprite::row_extent(uint16_t y, uint16_t *x0, uint16_t *x1) const {
+	const Span *first = spans_begin(y), *last = spans_end(y);
+	if (first == last) return false;
+	*x0 = first->x;
+	*x1 = last[-1].x + last[-1].length;
+	return true;
+}
+
+void RleSprite::decode_row(uint16_t y, uint32_t *dst, bool cleared) const {
+	// memset and memcpy are the vector kernels here: the C library picks SSE2, AVX2 or wider versions for the CPU
+	// when the program loads, and a span is too short for anything hand-written to beat them.
+	uint16_t x = 0;
+	for (const Span *s = spans_begin(y); s != spans_end(y); s++) {
+		if (!cleared) memset(dst + x, 0, (s->x - x) * sizeof(uint32_t));
+		memcpy(dst + s->x, pixels_of(*s), s->length * sizeof(uint32_t));
+		x = s->x + s->length;
+	}
+	if (!cleared) memset(dst + x, 0, (width - x) * sizeof(uint32_t));
+}
+
+size_t RleSprite::bytes() const {
+	return
+		row_start.capacity() * sizeof(uint32_t)
+		+ spans.capacity() * sizeof(Span)
+		+ pixels.capacity() * sizeof(uint32_t)
+	;
+}
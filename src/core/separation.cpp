@@ -0,0 +1,99 @@
+#include "separation.h"
+#include <algorithm>	// For min and max.
+#include <limits>	// For numeric_limits.
+
+
+void SeparationGrid::update(const vector<Animation*> &dragons) {
+	pair_count = 0;
+	if (dragons.size() < 2) return;
+	build(dragons);
+	pushes.assign(dragons.size(), 0);
+
+	for (uint32_t i = 0; i < dragons.size(); i++) {
+		const Box &a = boxes[i];
+		for (auto &g : grids) {
+			if (pushes[i] >= MaxPushes) break;
+			if (g.items.empty()) continue;
+			// Another dragon can only touch this one if its corner is up to its size above or left of this one.
+			const uint_fast32_t
+				c0 = max<int_fast32_t>(0, (a.x0 - g.reach - corner.x) / (int_fast32_t)g.cell),
+				r0 = max<int_fast32_t>(0, (a.y0 - g.reach - corner.y) / (int_fast32_t)g.cell),
+				c1 = min<uint_fast32_t>(g.cols - 1, (a.x1 - corner.x) / g.cell),
+				r1 = min<uint_fast32_t>(g.rows - 1, (a.y1 - corner.y) / g.cell)
+			;
+			for (uint_fast32_t r = r0; r <= r1 && pushes[i] < MaxPushes; r++) {
+				for (uint32_t k = g.starts[r * g.cols + c0]; k < g.starts[r * g.cols + c1 + 1]; k++) {
+					// Each pair is found from both sides, and handled from the lower index only.
+					const uint32_t j = g.items[k];
+					if (j <= i || pushes[j] >= MaxPushes) continue;
+					const Box &b = boxes[j];
+					if (a.x1 < b.x0 || b.x1 < a.x0 || a.y1 < b.y0 || b.y1 < a.y0) continue;
+					dragons[i]->steer_away_from(dragons[j]->area);
+					dragons[j]->steer_away_from(dragons[i]->area);
+					pair_count++;
+					pushes[j]++;
+					if (++pushes[i] >= MaxPushes) break;
+				}
+			}
+		}
+	}
+}
+
+
+uint_fast32_t SeparationGrid::cell_of(const Grid &g, Distance x, Distance y) const {
+	return (y - corner.y) / g.cell * g.cols + (x - corner.x) / g.cell;
+}
+
+void SeparationGrid::build(const vector<Animation*> &dragons) {
+	const size_t n = dragons.size();
+	boxes.resize(n);
+	levels.resize(n);
+	corner = {numeric_limits<Distance>::max(), numeric_limits<Distance>::max()};
+	Position far_corner = {numeric_limits<Distance>::min(), numeric_limits<Distance>::min()};
+	for (auto &g : grids) g.reach = 0;
+	for (size_t i = 0; i < n; i++) {
+		const Area &area = dragons[i]->area;
+		const Box b = {
+			(Distance)(area.origin.x - margin),
+			(Distance)(area.origin.y - margin),
+			(Distance)(area.origin.x + area.width + margin),
+			(Distance)(area.origin.y + area.height + margin)
+		};
+		boxes[i] = b;
+		const Distance size = max(b.x1 - b.x0, b.y1 - b.y0);
+		uint_fast8_t level = 0;
+		while (level + 1 < Levels && (Distance)(BaseCell << level) < size) level++;
+		levels[i] = level;
+		grids[level].reach = max(grids[level].reach, size);
+		corner = {min(corner.x, b.x0), min(corner.y, b.y0)};
+		far_corner = {max(far_corner.x, b.x0), max(far_corner.y, b.y0)};
+	}
+
+	// Counting sort into cells: count, turn counts into starts, then place.
+	for (uint_fast8_t level = 0; level < Levels; level++) {
+		Grid &g = grids[level];
+		g.cell = BaseCell << level;
+		g.cols = (far_corner.x - corner.x) / g.cell + 1;
+		g.rows = (far_corner.y - corner.y) / g.cell + 1;
+		g.starts.assign(g.cols * g.rows + 1, 0);
+		g.items.clear();
+	}
+	for (size_t i = 0; i < n; i++) {
+		Grid &g = grids[levels[i]];
+		g.starts[cell_of(g, boxes[i].x0, boxes[i].y0) + 1]++;
+		g.items.push_back(0);
+	}
+	for (auto &g : grids) {
+		for (size_t c = 1; c < g.starts.size(); c++) g.starts[c] += g.starts[c - 1];
+	}
+	for (uint_fast8_t level = 0; level < Levels; level++) {
+		Grid &g = grids[level];
+		if (g.items.empty()) continue;
+		filled.assign(g.cols * g.rows, 0);
+		for (uint32_t i = 0; i < n; i++) {
+			if (levels[i] != level) continue;
+			const uint_fast32_t c = cell_of(g, boxes[i].x0, boxes[i].y0);
+			g.items[g.starts[c] + filled[c]++] = i;
+		}
+	}
+}
@@ -0,0 +1,92 @@
+#include "workers.h"
+
+using namespace std;
+
+
+WorkStealingPool::WorkStealingPool(unsigned threads) {
+	if (threads < 1) threads = 1;
+	for (unsigned i = 0; i < threads; i++) queues.emplace_back(new Queue());
+	for (unsigned i = 1; i < threads; i++) this->threads.emplace_back(&WorkStealingPool::worker_loop, this, i);
+}
+
+WorkStealingPool::~WorkStealingPool() {
+	{
+		lock_guard<mutex> lock(m);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (auto &t : threads) t.join();
+}
+
+
+void WorkStealingPool::run(size_t count, const function<void(size_t)> &task) {
+	if (!count) return;
+	{
+		lock_guard<mutex> lock(m);
+		current = &task;
+		remaining = count;
+		// Deal tasks in contiguous runs, so each participant starts on neighbouring data.
+		const size_t per_queue = (count + queues.size() - 1) / queues.size();
+		for (size_t i = 0; i < count; i++) {
+			Queue &q = *queues[i / per_queue];
+			lock_guard<mutex> q_lock(q.m);
+			q.tasks.push_back(i);
+		}
+		generation++;
+	}
+	wake.notify_all();
+
+	work(0);
+
+	unique_lock<mutex> lock(m);
+	done.wait(lock, [this]{return remaining == 0;});
+	current = nullptr;
+}
+
+
+void WorkStealingPool::worker_loop(unsigned index) {
+	uint_fast64_t seen = 0;
+	while (true) {
+		{
+			unique_lock<mutex> lock(m);
+			wake.wait(lock, [&]{return stopping || generation != seen;});
+			if (stopping) return;
+			seen = generation;
+		}
+		work(index);
+	}
+}
+
+void WorkStealingPool::work(unsigned index) {
+	size_t task;
+	while (take(index, &task)) {
+		(*current)(task);
+		if (--remaining == 0) {
+			lock_guard<mutex> lock(m);	// Ensures run() is either waiting or yet to check remaining.
+			done.notify_all();
+		}
+	}
+}
+
+bool WorkStealingPool::take(unsigned index, size_t *task) {
+	{	// Own queue, newest first.
+		Queue &q = *queues[index];
+		lock_guard<mutex> lock(q.m);
+		if (!q.tasks.empty()) {
+			*task = q.tasks.back();
+			q.tasks.pop_back();
+			return true;
+		}
+	}
+	// Steal the oldest task from another participant.
+	for (unsigned i = 1; i < queues.size(); i++) {
+		Queue &q = *queues[(index + i) % queues.size()];
+		lock_guard<mutex> lock(q.m);
+		if (!q.tasks.empty()) {
+			*task = q.tasks.front();
+			q.tasks.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
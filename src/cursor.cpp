@@ -5,9 +5,10 @@
 #include <cmath>
 
 
-extern xcb_connection_t *conn;
-extern xcb_void_cookie_t cookie;
-extern xcb_generic_error_t *err;
+extern xcb_connection_t *resource_conn;
+// Cursors are built on a background thread while the game starts, so these aren't shared with the main thread.
+static thread_local xcb_void_cookie_t cookie;
+static thread_local xcb_generic_error_t *err;
 extern xcb_render_pictforminfo_t pfi;
 
 
@@ -17,46 +18,46 @@ xcb_cursor_t make_picture_cursor(const xcb_render_picture_t pic, hotspot_pair ho
 		return 0;
 	}
 	if (!cursor) {
-		if (! (cursor = xcb_generate_id(conn))) {
+		if (! (cursor = xcb_generate_id(resource_conn))) {
 			fprintf(stderr, "Failed to generate I.D. for cursor.\n");
 			return 0;
 		}
 	}
-	cookie = xcb_render_create_cursor_checked(conn,
+	cookie = xcb_render_create_cursor_checked(resource_conn,
 		cursor,
 		pic,
 		hotspot.x, hotspot.y
 	);
-	if ((err = xcb_request_check(conn, cookie))) {
+	if ((err = xcb_request_check(resource_conn, cookie))) {
 		fprintf(stderr, "Failed to create picture cursor.\n");
-		handle_error(conn, err);
+		handle_error(resource_conn, err);
 		return 0;
 	}
 	return cursor;
 }
 bool make_cursor_frame(xcb_render_animcursorelt_t *cursors, uint_fast8_t index, const cursor_specs_t *specs, uint32_t frame_delay) {
 	assert(frame_delay > 0);
-	cursors[index].cursor = xcb_generate_id(conn);
+	cursors[index].cursor = xcb_generate_id(resource_conn);
 	if (! make_picture_cursor(specs->iterator_pic, specs->hotspot, cursors[index].cursor)) return false;
 	cursors[index].delay = frame_delay;
 	return true;
 }
 bool set_original_picture(const cursor_specs_t *specs) {
-	xcb_render_picture_t pic = xcb_generate_id(conn);
-	cookie = xcb_render_create_picture_checked(conn,
+	xcb_render_picture_t pic = xcb_generate_id(resource_conn);
+	cookie = xcb_render_create_picture_checked(resource_conn,
 		pic,			// pid
 		specs->pixmap,		// drawable
 		pfi.id,			// format
 		0,			// value_mask
 		NULL			// *value_list
 	);
-	if ((err = xcb_request_check(conn, cookie))) {
+	if ((err = xcb_request_check(resource_conn, cookie))) {
 		fprintf(stderr, "Failed to create picture.\n");
-		handle_error(conn, err);
+		handle_error(resource_conn, err);
 		return false;
 	}
 
-	cookie = xcb_render_composite_checked(conn,
+	cookie = xcb_render_composite_checked(resource_conn,
 		XCB_RENDER_PICT_OP_SRC,		// Operation (PICTOP).
 		pic,				// Source (PICTURE).
 		XCB_RENDER_PICTURE_NONE,	// Mask (PICTURE or NONE).
@@ -66,9 +67,9 @@ bool set_original_picture(const cursor_specs_t *specs) {
 		0, 0,				// Destination start coordinates (INT16).
 		specs->width, specs->height	// Source dimensions to copy.
 	);
-	if ((err = xcb_request_check(conn, cookie))) {
+	if ((err = xcb_request_check(resource_conn, cookie))) {
 		fprintf(stderr, "Failed to render composite image.\n");
-		handle_error(conn, err);
+		handle_error(resource_conn, err);
 		return false;
 	}
 
@@ -76,17 +77,17 @@ bool set_original_picture(const cursor_specs_t *specs) {
 }
 bool rotate_clockwise(cursor_specs_t *specs, const float specified_degrees) {	// Used for animating cursor.
 	// Prepare a new picture container.
-	xcb_render_picture_t pic = xcb_generate_id(conn);
-	cookie = xcb_render_create_picture_checked(conn,
+	xcb_render_picture_t pic = xcb_generate_id(resource_conn);
+	cookie = xcb_render_create_picture_checked(resource_conn,
 		pic,		// pid
 		specs->pixmap,	// drawable
 		pfi.id,		// format
 		0,		// value_mask
 		NULL		// *value_list
 	);
-	if ((err = xcb_request_check(conn, cookie))) {
+	if ((err = xcb_request_check(resource_conn, cookie))) {
 		fprintf(stderr, "Failed to create cursor picture.\n");
-		handle_error(conn, err);
+		handle_error(resource_conn, err);
 		return false;
 	}
 
@@ -125,23 +126,23 @@ bool rotate_clockwise(cursor_specs_t *specs, const float specified_degrees) {	//
 		     0,     0,   1
 	);
 
-	xcb_render_set_picture_transform(conn, pic, transform);
+	xcb_render_set_picture_transform(resource_conn, pic, transform);
 
 
 	//
 	// Request filtering. Investigate anti-aliasing methods!
 	//
 
-	cookie = xcb_render_set_picture_filter_checked(conn,
+	cookie = xcb_render_set_picture_filter_checked(resource_conn,
 		pic,	// Picture.
 		4,	// strlen(filter).
 		"good",	// Filter name/alias.
 		0,	// values_len
 		NULL	// values (xcb_render_fixed_t*)
 	);
-	if ((err = xcb_request_check(conn, cookie))) {
+	if ((err = xcb_request_check(resource_conn, cookie))) {
 		fprintf(stderr, "Failed to add filter to image.\n");
-		handle_error(conn, err);
+		handle_error(resource_conn, err);
 		return false;
 	}
 
@@ -149,7 +150,7 @@ bool rotate_clockwise(cursor_specs_t *specs, const float specified_degrees) {	//
 	// Render the transformed picture:
 	//
 
-	cookie = xcb_render_composite_checked(conn,
+	cookie = xcb_render_composite_checked(resource_conn,
 		XCB_RENDER_PICT_OP_SRC,		// Operation (PICTOP).
 		pic,				// Source (PICTURE).
 		XCB_RENDER_PICTURE_NONE,	// Mask (PICTURE or NONE).
@@ -159,12 +160,12 @@ bool rotate_clockwise(cursor_specs_t *specs, const float specified_degrees) {	//
 		0, 0,				// Destination start coordinates (INT16).
 		specs->width, specs->height	// Source dimensions to copy.
 	);
-	if ((err = xcb_request_check(conn, cookie))) {
+	if ((err = xcb_request_check(resource_conn, cookie))) {
 		fprintf(stderr, "Failed to render composite image.\n");
-		handle_error(conn, err);
+		handle_error(resource_conn, err);
 		return false;
 	}
-	xcb_render_free_picture(conn, pic);
+	xcb_render_free_picture(resource_conn, pic);
 
 	return true;
 }
@@ -196,15 +197,15 @@ xcb_cursor_t make_rotating_cursor(cursor_specs_t *specs, const float rotations_p
 	uint_fast8_t cursor_ct = 0;
 
 	// Generate initial frame (without rotation):
-	specs->iterator_pic = xcb_generate_id(conn);
-	cookie = xcb_render_create_picture_checked(conn,
+	specs->iterator_pic = xcb_generate_id(resource_conn);
+	cookie = xcb_render_create_picture_checked(resource_conn,
 		specs->iterator_pic,	// pid
 		specs->pixmap,		// drawable
 		pfi.id,			// format
 		0,			// value_mask
 		NULL			// *value_list
 	);
-	if ((err = xcb_request_check(conn, cookie))) {
+	if ((err = xcb_request_check(resource_conn, cookie))) {
 		fprintf(stderr, "Failed to create initial cursor picture.\n");
 		return 0;
 	}
@@ -227,7 +228,7 @@ xcb_cursor_t make_rotating_cursor(cursor_specs_t *specs, const float rotations_p
 		// Turn the frame into a cursor:
 		if (! make_cursor_frame(cursors, cursor_ct++, specs, frame_delay)) {
 			for (uint_fast8_t i = 0; i < cursor_ct; i++) {
-				xcb_render_free_picture(conn, cursors[i].cursor);
+				xcb_render_free_picture(resource_conn, cursors[i].cursor);
 			}
 			return 0;
 		}
@@ -238,15 +239,15 @@ xcb_cursor_t make_rotating_cursor(cursor_specs_t *specs, const float rotations_p
 	}
 
 
-	xcb_cursor_t cursor = xcb_generate_id(conn);
-	cookie = xcb_render_create_anim_cursor_checked(conn,
+	xcb_cursor_t cursor = xcb_generate_id(resource_conn);
+	cookie = xcb_render_create_anim_cursor_checked(resource_conn,
 		cursor,
 		cursor_ct,
 		cursors
 	);
-	if ((err = xcb_request_check(conn, cookie))) {
+	if ((err = xcb_request_check(resource_conn, cookie))) {
 		fprintf(stderr, "Failed to create animated cursor.\n");
-		handle_error(conn, err);
+		handle_error(resource_conn, err);
 		return 0;
 	}
 	if (!cursor) {	// Not sure if possible.
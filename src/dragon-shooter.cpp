@@ -2,6 +2,9 @@
 #include <xcb/composite.h>
 #include <xcb/xcb_keysyms.h>
 #include <xcb/xcb_image.h>
+#include <xcb/shape.h>
+#include <xcb/sync.h>
+#include <xcb/screensaver.h>
 #include "render.h"
 #include "cursor.h"
 #include "errors.h"
@@ -11,24 +14,49 @@
 #include <cstdio>	// For printf.
 #include <iostream>	// For cout.
 #include <cstring>	// For strcmp.
+#include <cctype>	// For isdigit.
+
+// Used for reactor mode:
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>	// For read and close.
+#include <cerrno>
 
 // Used for reading image files:
 #include <filesystem>
 #include <fstream>
 #include <vector>
 #include <set>	// For sorting.
+#include <deque>
 #include "BMP.h"	// Testing...
 
 // Used for animation:
 #include "animation.h"
-#include <memory>	// For shared_ptr.
+#include "separation.h"
+#include "pool.h"
+#include "workers.h"
+#include "snapshot.h"
+#include "particles.h"
+#include "hitmask.h"
+#include "xbackends.h"
+#include "background.h"
+#include "metrics.h"
+#include "governor.h"
+#include "timers.h"
+#include <condition_variable>
 
 
 namespace fs = std::filesystem;
 using namespace std;
 
 
+// Input, window setup and anything else on the main thread use conn. Drawing and resource setup off the main thread
+// have connections of their own, so neither queues behind the other on libxcb's lock or in the server. Resources are
+// shared by XID. With --shared-connection, or if a connection can't be opened, these are all the same connection.
 xcb_connection_t *conn;
+xcb_connection_t *render_conn;		// For the render threads.
+xcb_connection_t *resource_conn;	// For building the cursor, and the simulation's pointer queries.
+bool separate_connections = true;
 xcb_screen_t *screen;
 
 bool has_system_compositor;
@@ -38,38 +66,136 @@ xcb_render_pictforminfo_t pfi;
 xcb_colormap_t cmap;
 xcb_window_t overlay, win;
 xcb_gcontext_t gc;
-xcb_cursor_t targeting_cursor;
-xcb_pixmap_t cursor_pixmap;
+// Shown while a button is held. Starts as the crosshair, and is swapped for the animated cursor once cursor_thread has built it.
+atomic<xcb_cursor_t> targeting_cursor {XCB_NONE};
+xcb_cursor_t crosshair_cursor = XCB_NONE;
+xcb_pixmap_t cursor_pixmap = XCB_NONE;
+xcb_gcontext_t cursor_fg = XCB_NONE, cursor_transparent = XCB_NONE;
 xcb_render_picture_t cursor_pic;
 
 xcb_generic_error_t *err;
-xcb_void_cookie_t cookie;
 
-xcb_render_picture_t bg;
 xcb_pixmap_t fake_bg;
 
+// Selected with --backend. XRender draws on the server, software blends on the client, and null only counts.
+enum BackendKind {
+	XRender,
+	Software,
+	Null
+} backend_kind = XRender;
+const char *record_path = nullptr;	// Also write render commands here.
+bool use_cache = true;	// Keep filtered mip levels between launches.
+size_t sprite_budget = 0;	// Bytes of server memory for the XRender backend's sprite atlas. Zero for no limit.
+static const unsigned long MaxSpriteBudget = 1 << 20;	// In MiB, so the budget in bytes can't overflow.
+unique_ptr<RenderBackend> backend;
+vector<FrameImage> frame_images;
+// The main window's last frame, until its time is recorded. Only used by the thread drawing it.
+bool frame_pending = false;
+chrono::steady_clock::time_point frame_started;
+
+// Shaping limits the window to the dragons, so the system compositor only blends those areas and clicks elsewhere fall through.
+bool use_shape = false;
+static const uint_fast8_t ShapeMargin = 16;	// Pixels around each dragon.
+vector<xcb_rectangle_t> shape_rects;
+
+// Without a system compositor, keep fake_bg in step with the desktop using DAMAGE.
+bool use_live_background = false;
+LiveBackground live_background;
+vector<xcb_rectangle_t> refreshed_background;
+
+// With --all-screens, every other X screen gets a window of its own, laid out to the right of the main one.
+// The simulation is shared, so dragons fly between them. The main window keeps the keyboard, shape and live background.
+bool all_screens = false;
+typedef struct {
+	xcb_screen_t *screen;
+	xcb_window_t window;
+	xcb_colormap_t cmap;
+	xcb_gcontext_t gc;
+	xcb_pixmap_t background;	// Copy of the desktop, without a system compositor on that screen. Otherwise XCB_NONE.
+	Distance x;			// Left edge in the dragon area.
+	uint16_t width, height;
+	unique_ptr<RenderBackend> backend;
+	TripleBuffer<FrameSnapshot> snapshots, presented;	// In the window's coordinates.
+	thread render_thread;
+} ScreenOutput;
+deque<ScreenOutput> screen_outputs;	// Never moved once created, as the buffers hold atomics.
+
+// While no window can be seen, because each is fully obscured or the screen saver is on, the simulation stops stepping.
+// Nothing is then drawn or queried, and no thread wakes until something is visible again. Dragons carry on where they were.
+atomic<bool> hidden {false};
+vector<xcb_window_t> obscured_windows;	// Event thread only.
+bool screen_saver_on = false;		// Event thread only.
+uint8_t screen_saver_event = 0;		// Event code of MIT-SCREEN-SAVER notifications. Zero without the extension.
+mutex hidden_mutex;
+condition_variable unhidden;
+
+MetricsServer metrics_server;
+const char *metrics_socket = nullptr;
+
 xcb_get_geometry_reply_t *win_geom;
-thread animate_thread, spawn_thread;
+thread animate_thread, render_thread, spawn_thread, cursor_thread;
 atomic<bool> run {true};	// Not sure if this really needs to be atomic.
 
-Area win_area;
-const uint_fast8_t CursorEffectDistancePixels = 100;	// This is the area's apothem (because the math is simpler for a square than for a circle).
-Area cursor_effect_area;
-
-
 
-using dragon = shared_ptr<Animation>;
+using dragon = Animation*;	// Owned by pool.
 vector<dragon> dragons;
-
-
-static const uint_fast8_t MaxDragons = 3;
-
-
-
-bool get_picture_format() {
+AnimationPool pool;
+SeparationGrid broad_phase;	// Dragon-to-dragon separation.
+ParticleSystem sparks;	// Thrown out by kills. Stepped with the simulation.
+mt19937 spark_rng;	// Seeded from simulation_seed.
+
+// Timed behaviour, counted in simulation steps, so each step only touches what is due.
+typedef struct {
+	enum {Age, Spawn} kind;
+	dragon d;		// For Age.
+	uint_fast32_t life;	// Of d when scheduled. Timers that outlive a dragon are ignored once its slot is reused.
+} TimedEvent;
+TimerWheel<TimedEvent> timers;	// Used only by the thread stepping the simulation, or before it starts.
+bool top_up_on_spawn = false;	// In reactor mode, where there is no spawn thread to do it.
+
+// Simulation is stepped in fixed chunks. Each chunk seeds its own random stream from the frame and chunk index,
+// so the outcome is the same whether chunks run serially or on any number of threads.
+static const size_t
+	SimulationChunk = 256,		// Dragons per chunk.
+	ParallelThreshold = 1024	// Dragons before chunks are spread across threads.
+;
+uint_fast32_t simulation_seed;
+uint_fast64_t simulation_frame = 0;
+unique_ptr<WorkStealingPool> workers;	// Started the first time the threshold is exceeded.
+
+// The simulation publishes a snapshot of each frame for the renderer, which passes each frame it draws on to the click handler.
+// Clicks are tested against what is on screen, and neither reads live dragons.
+TripleBuffer<FrameSnapshot> render_snapshots, presented_snapshots;
+HitMasks hit_masks;	// Built once the frames are loaded. Read only after that.
+static const Distance ClickTolerance = 2;	// Pixels around a click that also count, so thin parts can still be hit.
+mutex snapshot_mutex;
+condition_variable snapshot_ready;	// Wakes the render threads. The simulation only holds the lock for an instant.
+atomic<size_t> alive {0};	// Dragons spawned and not yet killed.
+
+// Kills removed from the simulation but not yet drawn, for measuring click-to-present latency.
+typedef struct {
+	uint_fast64_t first_frame_without;	// Snapshot frame number from which the dragon is gone.
+	chrono::steady_clock::time_point clicked;
+} PendingKill;
+mutex pending_kills_mutex;
+vector<PendingKill> pending_kills;	// Appended by the simulation and drained by the renderer. Kills are rare, so a lock is fine.
+
+
+static uint_fast32_t MaxDragons = 3;
+static uint_fast16_t SpawnBurst = 1;	// Dragons spawned at once.
+static const uint_fast16_t PoolBatch = 256;	// Slots created at startup, then per top-up.
+
+// Stress mode spawns large bursts, for testing performance:
+bool stress = false;
+static uint_fast32_t StressMaxDragons = 2000;	// Can be set from the command line.
+static const uint_fast16_t StressSpawnBurst = 100;
+
+
+
+bool get_picture_format(xcb_render_query_pict_formats_cookie_t fc) {
 	// https://coral.googlesource.com/weston-imx/+/refs/tags/3.0.0-3/xwayland/window-manager.c#2441
-	auto fc = xcb_render_query_pict_formats(conn);
 	auto *fr = xcb_render_query_pict_formats_reply(conn, fc, 0);
+	if (!fr) return false;
 	auto formats = xcb_render_query_pict_formats_formats(fr);
 	for (uint32_t i = 0; i < fr->num_formats; i++) {
 		if (
@@ -93,18 +219,30 @@ bool get_picture_format() {
 	return false;
 }
 
-bool supports_transparency() {
+xcb_visualtype_t *find_argb_visual(xcb_screen_t *s) {
+	// Get 32-bit visual for screen:
+	xcb_visualtype_t *found = nullptr;
+	xcb_depth_iterator_t depth_iter;
+	depth_iter = xcb_screen_allowed_depths_iterator (s);
+	for (; depth_iter.rem; xcb_depth_next (&depth_iter)) {
+		xcb_visualtype_iterator_t visual_iter;
+
+		visual_iter = xcb_depth_visuals_iterator (depth_iter.data);
+		for (; visual_iter.rem; xcb_visualtype_next (&visual_iter)) {
+			if (visual_iter.data->_class == 4) {
+				found = visual_iter.data;
+			}
+		}
+	}
+	return found;
+}
+
+bool supports_transparency(xcb_intern_atom_cookie_t atom_cookie, const char *atom_name) {
 	// There is a function for this in "xcb_ewmh.h" but I'm hoping not to include that.
 	// https://specifications.freedesktop.org/wm-spec/wm-spec-1.4.html
 	// https://xcb.pdx.freedesktop.narkive.com/mhW25mhf/window-transparency-and-clearing-a-window
-	auto iar = xcb_intern_atom_reply(conn,
-		xcb_intern_atom(conn,
-			true,		// only_if_exists (do not create).
-			14,		// Name length.
-			"_NET_WM_CM_S0"	// Name.
-		),
-		&err
-	);
+	// The atom is requested by the caller, along with other startup requests.
+	auto iar = xcb_intern_atom_reply(conn, atom_cookie, &err);
 	if (err) {
 		fprintf(stderr, "Failed to query internal atom by name.\n");
 		handle_error(conn, err);
@@ -117,21 +255,176 @@ bool supports_transparency() {
 		&err
 	);
 	if (err) {
-		fprintf(stderr, "Failed to query owner of atom: \"_NET_WM_CM_S0\"\n");
+		fprintf(stderr, "Failed to query owner of atom: \"%s\"\n", atom_name);
 		return false;
 	}
 
 	if (gsor->owner) {
-		printf("Owner of atom \"_NET_WM_CM_S0\" is: %d\n", gsor->owner);
+		printf("Owner of atom \"%s\" is: %d\n", atom_name, gsor->owner);
 		free(gsor);
 		return true;
 	} else {
-		printf("Failed to detect owner of atom: _NET_WM_CM_S0\n");
+		printf("Failed to detect owner of atom: %s\n", atom_name);
 		free(gsor);
 		return false;
 	}
 }
 
+xcb_void_cookie_t make_crosshair_cursor() {
+	// From the core cursor font, so it is ready without drawing anything.
+	const xcb_font_t font = xcb_generate_id(conn);
+	xcb_open_font(conn, font, 6, "cursor");
+	crosshair_cursor = xcb_generate_id(conn);
+	const auto c = xcb_create_glyph_cursor_checked(conn,
+		crosshair_cursor,
+		font, font,
+		34, 35,		// Crosshair glyph, and its mask.
+		65535, 0, 0,	// Foreground (red).
+		0, 0, 0		// Background.
+	);
+	xcb_close_font(conn, font);
+	targeting_cursor = crosshair_cursor;
+	return c;
+}
+
+void build_targeting_cursor(bool found_pfi) {
+	// Runs on cursor_thread, while the game starts. Replaces the crosshair once it succeeds.
+	xcb_void_cookie_t cookie;
+	xcb_generic_error_t *err;
+	{
+		// Define cursor colour:
+		xcb_alloc_color_reply_t *acr = xcb_alloc_color_reply(resource_conn,
+			xcb_alloc_color(resource_conn,
+				cmap,
+				65535,	// Red.
+				0,	// Green.
+				0	// Blue.
+			),
+			NULL
+		);
+		if (!acr) {
+			fprintf(stderr, "Failed to allocate cursor colour.\n");
+			return;
+		}
+		const uint32_t MakeOpaque = found_pfi ? pfi.direct.alpha_mask << pfi.direct.alpha_shift : 0;
+
+		// Create the cursor's graphical contexts:
+		uint32_t value_mask =
+			XCB_GC_FOREGROUND
+			| XCB_GC_BACKGROUND
+			| XCB_GC_LINE_WIDTH
+			| XCB_GC_CAP_STYLE
+			| XCB_GC_FILL_STYLE
+			| XCB_GC_GRAPHICS_EXPOSURES
+		;
+		uint32_t value_list[6] = {
+			acr->pixel + MakeOpaque,
+			0,
+			2,
+			XCB_CAP_STYLE_ROUND,
+			XCB_FILL_STYLE_SOLID,
+			false
+		};
+		free(acr);
+		cursor_fg = xcb_generate_id(resource_conn);
+		cookie = xcb_create_gc_checked(resource_conn, cursor_fg, win, value_mask, value_list);
+		if ((err = xcb_request_check(resource_conn, cookie))) {
+			fprintf(stderr, "Failed to create graphical context.\n");
+			handle_error(resource_conn, err);
+		}
+		value_list[0] = 0;	// Transparent.
+		value_list[1] = 0;	// Transparent.
+		cursor_transparent = xcb_generate_id(resource_conn);
+		cookie = xcb_create_gc_checked(resource_conn, cursor_transparent, win, value_mask, value_list);
+		if ((err = xcb_request_check(resource_conn, cookie))) {
+			fprintf(stderr, "Failed to create graphical context.\n");
+			handle_error(resource_conn, err);
+		}
+	}
+
+	const uint_fast8_t CursorSize = 60;
+
+	// Create pixmap:
+	cursor_pixmap = xcb_generate_id(resource_conn);
+	cookie = xcb_create_pixmap_checked(resource_conn,
+		32,	// Depth.
+		cursor_pixmap,
+		win,
+		CursorSize, CursorSize
+	);
+	if ((err = xcb_request_check(resource_conn, cookie))) {
+		fprintf(stderr, "Failed to create pixmap.\n");
+		handle_error(resource_conn, err);
+	}
+	{	// Draw transparent background into pixmap:
+		if (has_system_compositor) {
+			cookie = xcb_clear_area_checked(resource_conn,	// Not sure if this works.
+				false,			// Trigger expose event.
+				cursor_pixmap,
+				0, 0,
+				CursorSize, CursorSize
+			);
+			if ((err = xcb_request_check(resource_conn, cookie))) {
+				fprintf(stderr, "Failed to clear pixmap area.\n");
+				handle_error(resource_conn, err);
+			}
+		} else {
+			xcb_rectangle_t bg_rectangle = {0, 0, CursorSize, CursorSize};
+			cookie = xcb_poly_fill_rectangle_checked(resource_conn,
+				cursor_pixmap,
+				cursor_transparent,
+				1,
+				&bg_rectangle
+			);
+			if ((err = xcb_request_check(resource_conn, cookie))) {
+				fprintf(stderr, "Failed to draw cursor background.\n");
+				handle_error(resource_conn, err);
+			}
+		}
+	}
+	{	// Draw targeting cursor into pixmap:
+		xcb_segment_t segments[] = {
+			{	// Vertical.
+				CursorSize/2, 0,
+				CursorSize/2, CursorSize
+			},
+			{	// Horizontal.
+				0, CursorSize/2,
+				CursorSize, CursorSize/2
+			}
+		};
+		cookie = xcb_poly_segment_checked(resource_conn,
+			cursor_pixmap,
+			cursor_fg,
+			2,		// Number of segments.
+			segments
+		);
+		if ((err = xcb_request_check(resource_conn, cookie))) {
+			fprintf(stderr, "Failed to draw cursor lines.\n");
+			handle_error(resource_conn, err);
+		}
+	}
+	hotspot_pair hotspot = {CursorSize/2, CursorSize/2};
+	xcb_cursor_t cursor;
+	if (found_pfi) {
+		cursor_specs_t cursor_specs = {
+			.pixmap = cursor_pixmap,
+			.width = CursorSize,
+			.height = CursorSize,
+			.hotspot = hotspot,
+			.fg = cursor_fg
+		};
+		if (! (cursor = make_rotating_cursor(&cursor_specs, 0.15, 12))) {
+			fprintf(stderr, "Failed to make rotating cursor.\n");
+		}
+	} else {
+		if (! (cursor = make_picture_cursor(cursor_pic, hotspot))) {
+			fprintf(stderr, "Failed to make cursor.\n");
+		}
+	}
+	if (cursor) targeting_cursor = cursor;	// Used from the next button press.
+}
+
 
 unsigned short get_files(vector<BMP> *files) {
 	fs::path WD = fs::canonical("/proc/self/exe").parent_path();
@@ -156,7 +449,7 @@ unsigned short get_files(vector<BMP> *files) {
 	return files->size();
 }
 
-unsigned short init_pixmaps() {
+unsigned short load_frames() {
 	vector<BMP> files;
 	if (!get_files(&files)) return 0;
 
@@ -166,308 +459,979 @@ unsigned short init_pixmaps() {
 		if (Animation::initial_height < file.bmp_info_header.height)
 			Animation::initial_height = file.bmp_info_header.height;
 
-		xcb_image_t *img = xcb_image_create_native(conn,
-			Animation::initial_width,	// Width.
-			Animation::initial_height,	// Height.
-			XCB_IMAGE_FORMAT_Z_PIXMAP,	// Format.
-			32,				// Depth.
-			NULL, 				// "base".
-			0,			 	// Data length (bytes).
-			NULL				// Data.
-		);
-		if (!img) {
-			fprintf(stderr, "Failed to load image!\n");
-			continue;
-		}
-
 		file.flip_vertically();
-		img->data = file.data.data();
-
-		// Create pixmap (buffer):
-		auto pixmap = xcb_generate_id(conn);
-		Animation::pixmaps.push_back(pixmap);
-		xcb_create_pixmap(conn,
-			32,
-			pixmap,
-			win,
-			Animation::initial_width,
-			Animation::initial_height
-		);
-
-		// Load image into pixmap:
-		xcb_image_put(conn,
-			pixmap,
-			gc,
-			img,
-			0, 0,
-			0
-		);
-
-		xcb_image_destroy(img);
+		frame_images.push_back(FrameImage{
+			.width = (uint16_t)file.bmp_info_header.width,
+			.height = (uint16_t)file.bmp_info_header.height,
+			.bgra = move(file.data)
+		});
 	}
 
-	return Animation::pixmaps.size();
+	Animation::frame_count = frame_images.size();
+	return Animation::frame_count;
 }
 
 
 
-void clear_window() {
-	if (has_system_compositor) {
-		xcb_clear_area(conn,
-			false,		// Trigger expose event.
-			win,
-			0, 0,
-			win_geom->x, win_geom->y
-		);
-	} else {
-		xcb_copy_area(conn,
-			fake_bg,
+void update_window_shape(const FrameSnapshot &snapshot) {
+	shape_rects.clear();
+	for (auto &d : snapshot.dragons) {
+		// The server clips to the window and merges overlapping rectangles.
+		shape_rects.push_back(xcb_rectangle_t{
+			(int16_t)(d.origin.x - ShapeMargin),
+			(int16_t)(d.origin.y - ShapeMargin),
+			(uint16_t)(d.width + 2 * ShapeMargin),
+			(uint16_t)(d.height + 2 * ShapeMargin)
+		});
+	}
+	// Sparks are shown but let clicks through, so the input shape is only the dragons.
+	const size_t dragon_rects = shape_rects.size();
+	for (auto &s : snapshot.sparks) shape_rects.push_back(xcb_rectangle_t{s.x, s.y, s.size, s.size});
+	for (auto kind : {XCB_SHAPE_SK_BOUNDING, XCB_SHAPE_SK_INPUT}) {
+		xcb_shape_rectangles(render_conn,
+			XCB_SHAPE_SO_SET,
+			kind,
+			XCB_CLIP_ORDERING_UNSORTED,
 			win,
-			gc,
-			0, 0,
-			0, 0,
-			screen->width_in_pixels,
-			screen->height_in_pixels
+			0, 0,			// Offset.
+			kind == XCB_SHAPE_SK_INPUT ? dragon_rects : shape_rects.size(),
+			shape_rects.data()
 		);
 	}
 }
 
-void draw_dragons() {
-	// Create clean picture of background:
-	clear_window();
-	bg = xcb_generate_id(conn);	// Needed for transparency when has_system_compositor is false.
-	xcb_render_create_picture_checked(conn,
-		bg,		// pid
-		win,		// drawable
-		pfi.id,		// format
-		0,		// value_mask
-		NULL		// *value_list
-	);
-	if ((err = xcb_request_check(conn, cookie))) {
-		cerr << "Failed to create background picture." << endl;
-	}
-
-	// Draw the dragons:
-	for (auto di = dragons.begin(); di != dragons.end(); di++) {
-		// Remove dead dragons:
-		// It would be more efficient to handle this in the dragons' move method, since that occurs before this within the animation loop.
-		// That is not currently possible because the class can't currently remove its pointer from the application's vector.
-		auto d = *di;
-		if (d->dead) {	// If, not while, to allow for breaking loop. Less stutter when bg is flushed to win.
-			di = dragons.erase(di);
-			if (di == dragons.end()) break;
-			d = *di;
-		}
-
-		// Advance animation frame:
-		if (++(d->stage) == d->pictures->end()) d->stage = d->pictures->begin();
-
-		// Load pixmap in window:
-		xcb_render_composite_checked(conn,
-			XCB_RENDER_PICT_OP_OVER,		// Operation (PICTOP).
-			*d->stage,				// Source (PICTURE).
-			*d->stage,				// Mask (PICTURE or NONE).
-			bg,					// Destination (PICTURE).
-			0, 0,					// Source start coordinates (INT16).
-			0, 0,					// Mask start coordinates (INT16)?
-			d->area.origin.x, d->area.origin.y,	// Destination start coordinates (INT16).
-			d->area.width, d->area.height	// Source dimensions to copy.
-		);
-		if ((err = xcb_request_check(conn, cookie))) {
-			cerr << "Failed to render composite image." << endl;
+void record_presented_kills(uint_fast64_t frame_number, chrono::steady_clock::time_point presented) {
+	lock_guard<mutex> lock(pending_kills_mutex);
+	for (auto k = pending_kills.begin(); k != pending_kills.end();) {
+		if (k->first_frame_without > frame_number) {
+			k++;
 			continue;
 		}
+		metrics.present_latency.record(presented - k->clicked);
+		k = pending_kills.erase(k);
 	}
+}
 
+void discard_render_events() {
+	// Nothing selects events on the render connection, but errors from unchecked requests still queue up there.
+	// They are dropped, as they are by the event loop.
+	if (render_conn == conn) return;	// The event loop reads them.
+	while (xcb_generic_event_t *e = xcb_poll_for_event(render_conn)) free(e);
+}
 
-	xcb_flush(conn);
-	xcb_render_free_picture(conn, bg);
-	return;
+void finish_frame() {
+	// Times the last frame of the main window from its start until the server has drawn it, for the governor.
+	if (!frame_pending) return;
+	frame_pending = false;
+	backend->await_completion();
+	metrics.quality_tier.set(governor.record(chrono::steady_clock::now() - frame_started));
+}
+
+void draw_dragons(const FrameSnapshot &snapshot) {
+	finish_frame();
+	const auto started = chrono::steady_clock::now();
+	metrics.alive.set(snapshot.dragons.size());
+	metrics.sparks.set(snapshot.sparks.size());
+	metrics.frames.add();
+	backend->set_smooth_scaling(governor.tier() < QualityGovernor::NearestFilter);
+
+	if (use_shape) update_window_shape(snapshot);
+	if (use_live_background) {
+		refreshed_background.clear();
+		live_background.refresh(&refreshed_background);
+		for (auto &r : refreshed_background) backend->invalidate(r.x, r.y, r.width, r.height);
+	}
+
+	backend->begin_frame(snapshot.frame_number);
+	for (auto &d : snapshot.dragons) backend->draw_sprite(d);
+	backend->draw_sparks(snapshot.sparks);
+	backend->end_frame();
+	// Sequence numbers are shared by all threads using a connection, so this counts every drawing request once per frame.
+	// Input and setup traffic on the other connections is left out, but it is small. The no-op costs four bytes.
+	metrics.note_sequence(xcb_no_operation(render_conn).sequence);
+	discard_render_events();
+
+	const auto presented = chrono::steady_clock::now();
+	metrics.frame_time.record(presented - started);
+	frame_started = started;
+	frame_pending = true;
+	// Otherwise, finished by the next frame or before the drawing thread goes idle, whichever comes first.
+	if (!backend->completes_on_server()) finish_frame();
+
+	FrameSnapshot &shown = presented_snapshots.back();
+	shown.frame_number = snapshot.frame_number;
+	shown.dragons.assign(snapshot.dragons.begin(), snapshot.dragons.end());	// Keeps capacity.
+	presented_snapshots.publish();
+	record_presented_kills(snapshot.frame_number, presented);
+}
+
+void draw_screen(ScreenOutput &o, const FrameSnapshot &snapshot) {
+	// Paced by its own thread, and left out of the governor, which follows the main window.
+	const auto started = chrono::steady_clock::now();
+	o.backend->set_smooth_scaling(governor.tier() < QualityGovernor::NearestFilter);
+	o.backend->begin_frame(snapshot.frame_number);
+	for (auto &d : snapshot.dragons) o.backend->draw_sprite(d);
+	o.backend->draw_sparks(snapshot.sparks);
+	o.backend->end_frame();
+	discard_render_events();
+	metrics.frame_time.record(chrono::steady_clock::now() - started);
+
+	FrameSnapshot &shown = o.presented.back();
+	shown.frame_number = snapshot.frame_number;
+	shown.dragons.assign(snapshot.dragons.begin(), snapshot.dragons.end());
+	o.presented.publish();
 }
 
 void update_cursor_position() {
-	xcb_query_pointer_reply_t *qpr = xcb_query_pointer_reply(conn,
-		xcb_query_pointer(conn, win),
-		&err
-	);
+	const auto qpc = xcb_query_pointer(resource_conn, win);
+	metrics.round_trips.add();
+	xcb_query_pointer_reply_t *qpr = xcb_query_pointer_reply(resource_conn, qpc, &err);
+	if (!qpr) return;
+	Distance x_offset = 0;
 	if (!qpr->same_screen) {
-		fprintf(stderr, "Warning: multi-screen setups have not been tested.\n");
+		// Ask again relative to the window on the pointer's screen, if there is one.
+		const auto o = find_if(screen_outputs.begin(), screen_outputs.end(), [qpr](const ScreenOutput &o) {return o.screen->root == qpr->root;});
+		if (o == screen_outputs.end()) {
+			fprintf(stderr, "Warning: multi-screen setups have not been tested.\n");
+		} else if (auto *screen_qpr = xcb_query_pointer_reply(resource_conn, xcb_query_pointer(resource_conn, o->window), &err)) {
+			metrics.round_trips.add();
+			free(qpr);
+			qpr = screen_qpr;
+			x_offset = o->x;
+		}
 	}
+	const Distance x = qpr->win_x + x_offset, y = qpr->win_y;
 	cursor_effect_area = {
 		.origin = {
-			(int_fast16_t)(qpr->win_x) - CursorEffectDistancePixels,
-			(int_fast16_t)(qpr->win_y) - CursorEffectDistancePixels
+			x - CursorEffectDistancePixels,
+			y - CursorEffectDistancePixels
 		},
 		.width = 2 * CursorEffectDistancePixels,
 		.height = 2 * CursorEffectDistancePixels,
-		.center = Position{qpr->win_x, qpr->win_y},
+		.center = Position{x, y},
 	};
 	free(qpr);
 }
 
-void animate() {
-	static const auto RefreshRate = chrono::milliseconds(150);
+static const auto BaseStep = chrono::milliseconds(150);	// Speeds are given per base step. See Animation::step_scale.
+static chrono::nanoseconds step_period = BaseStep;	// Between simulation steps, and so between frames. Set by --step-rate.
+static const unsigned long MaxStepRate = 1000;	// In Hz. Faster steps would be too short to time or to draw.
+
+static uint_fast64_t steps_in(chrono::steady_clock::duration d) {
+	// Rounded up, so timers never fire early.
+	return (d + step_period - chrono::nanoseconds(1)) / step_period;
+}
+
+static inline bool far_from_cursor(const Animation &d) {
+	// Far enough outside the effect area that missing the cursor for a step changes nothing.
+	const int reach = 2 * CursorEffectDistancePixels + max(d.area.width, d.area.height) + Animation::max_escape_speed;
+	return
+		abs(d.area.center.x - cursor_effect_area.center.x) > reach
+		|| abs(d.area.center.y - cursor_effect_area.center.y) > reach
+	;
+}
+
+void move_chunk(size_t chunk, size_t dragon_ct, QualityGovernor::Tier tier) {
+	seed_seq seq{
+		(uint_fast32_t)simulation_seed,
+		(uint_fast32_t)(simulation_frame & 0xffffffff),
+		(uint_fast32_t)(simulation_frame >> 32),
+		(uint_fast32_t)chunk
+	};
+	mt19937 rng(seq);
+	const size_t end = min(dragon_ct, (chunk + 1) * SimulationChunk);
+	// Degraded tiers do some of the work on alternate steps only.
+	const bool odd_step = simulation_frame & 1;
+	for (size_t i = chunk * SimulationChunk; i < end; i++) {
+		Animation &d = *dragons[i];
+		d.move(rng, tier < QualityGovernor::SparseEvasion || !odd_step || d.evasion_vector || !far_from_cursor(d));
+		if (tier < QualityGovernor::HeldFrames || !odd_step) d.advance_stage();
+	}
+}
+
+void remove_dead_dragons(chrono::steady_clock::time_point now) {
+	for (auto di = dragons.begin(); di != dragons.end();) {
+		dragon d = *di;
+		if (!d->dead()) {
+			di++;
+			continue;
+		}
+		metrics.kill_latency.record(now - d->killed_at);
+		{
+			lock_guard<mutex> lock(pending_kills_mutex);
+			pending_kills.push_back(PendingKill{simulation_frame + 1, d->killed_at});	// simulate() advances the frame number before publishing.
+		}
+		sparks.burst(d->area, spark_rng);
+		pool.release(d);	// Pictures stay valid, so older snapshots can still be drawn.
+		di = dragons.erase(di);
+	}
+}
+
+void fire_timer(const TimedEvent &e, chrono::steady_clock::time_point now);
+
+void simulate() {
+	const auto now = chrono::steady_clock::now();	// One timestamp for everything timed in this step.
+	remove_dead_dragons(now);
+	timers.advance([now](const TimedEvent &e) {fire_timer(e, now);});
+	update_cursor_position();
+	broad_phase.update(dragons);	// Accumulates separation vectors, which are applied by move().
+
+	const auto started = chrono::steady_clock::now();
+	const size_t dragon_ct = dragons.size();
+	const size_t chunk_ct = (dragon_ct + SimulationChunk - 1) / SimulationChunk;
+	const auto tier = governor.tier();	// The same for every chunk.
+	if (dragon_ct > ParallelThreshold) {
+		if (!workers) workers.reset(new WorkStealingPool());
+		workers->run(chunk_ct, [dragon_ct, tier](size_t chunk) {move_chunk(chunk, dragon_ct, tier);});
+	} else {
+		for (size_t chunk = 0; chunk < chunk_ct; chunk++) move_chunk(chunk, dragon_ct, tier);
+	}
+	sparks.step();
+	metrics.move_time.record(chrono::steady_clock::now() - started);
+	simulation_frame++;
+}
+
+void wake_renderers() {
+	// Taking the lock, however briefly, means each renderer has either not yet checked for a frame (and will find it)
+	// or is already waiting, so none misses the notification.
+	{lock_guard<mutex> lock(snapshot_mutex);}
+	snapshot_ready.notify_all();
+}
+
+void wait_while_hidden() {
+	unique_lock<mutex> lock(hidden_mutex);
+	unhidden.wait(lock, []{return !hidden || !run;});
+}
 
+void publish_snapshot() {
+	const size_t dragon_ct = dragons.size();
+	FrameSnapshot &snapshot = render_snapshots.back();
+	snapshot.frame_number = simulation_frame;
+	snapshot.dragons.clear();	// Keeps capacity, so publishing stops allocating once the swarm has peaked.
+	for (size_t i = 0; i < dragon_ct; i++) {
+		if (dragons[i]->dead()) continue;
+		snapshot.dragons.push_back(snapshot_of(*dragons[i]));
+	}
+	sparks.snapshot(&snapshot.sparks);
+	if (!screen_outputs.empty()) {
+		// Each window gets the dragons over it, moved into its coordinates. The main window's are already in them.
+		for (auto &o : screen_outputs) {
+			FrameSnapshot &part = o.snapshots.back();
+			part.frame_number = snapshot.frame_number;
+			part.dragons.clear();
+			for (auto d : snapshot.dragons) {
+				if (d.origin.x + d.width <= o.x || d.origin.x >= o.x + o.width) continue;
+				d.origin.x -= o.x;
+				part.dragons.push_back(d);
+			}
+			part.sparks.clear();
+			for (auto s : snapshot.sparks) {
+				if (s.x + s.size <= o.x || s.x >= o.x + o.width) continue;
+				s.x -= o.x;
+				part.sparks.push_back(s);
+			}
+			o.snapshots.publish();
+		}
+		const Distance main_width = screen->width_in_pixels;
+		snapshot.dragons.erase(
+			remove_if(snapshot.dragons.begin(), snapshot.dragons.end(), [main_width](const DragonSnapshot &d) {return d.origin.x >= main_width;}),
+			snapshot.dragons.end()
+		);
+		snapshot.sparks.erase(
+			remove_if(snapshot.sparks.begin(), snapshot.sparks.end(), [main_width](const SparkSnapshot &s) {return s.x >= main_width;}),
+			snapshot.sparks.end()
+		);
+	}
+	render_snapshots.publish();
+	wake_renderers();
+}
+
+void render() {
+	// Draws the latest published frame. Frames published faster than they can be drawn are skipped.
+	while (run) {
+		if (!render_snapshots.update()) {
+			finish_frame();	// Before sleeping, so waiting for the next snapshot isn't counted as drawing.
+			unique_lock<mutex> lock(snapshot_mutex);
+			// No timeout, so nothing wakes while the simulation is paused. See wake_renderers().
+			snapshot_ready.wait(lock, []{return render_snapshots.fresh() || !run;});
+			continue;
+		}
+		draw_dragons(render_snapshots.front());
+	}
+}
+
+void render_screen(ScreenOutput *o) {
+	// Like render(), for another screen.
+	while (run) {
+		if (!o->snapshots.update()) {
+			unique_lock<mutex> lock(snapshot_mutex);
+			snapshot_ready.wait(lock, [o]{return o->snapshots.fresh() || !run;});
+			continue;
+		}
+		draw_screen(*o, o->snapshots.front());
+	}
+}
+
+void animate() {
 	// Conditionally add breakpoints for quick termination under load of dragons.
 	// I don't know whether this is at all useful. Numbers were chosen arbitrarily.
 	if (MaxDragons < 5) while (run) {
-		update_cursor_position();
-		for (auto d : dragons) d->move();
-		draw_dragons();
-		this_thread::sleep_for(chrono::milliseconds(RefreshRate));
+		simulate();
+		publish_snapshot();
+		this_thread::sleep_for(step_period);
+		wait_while_hidden();
 	} else if (MaxDragons < 8) while (run) {
-		update_cursor_position();
-		for (auto d : dragons) d->move();
+		simulate();
 		if (!run) break;	// Conditionally selected.
-		draw_dragons();
-		this_thread::sleep_for(chrono::milliseconds(RefreshRate));
+		publish_snapshot();
+		this_thread::sleep_for(step_period);
+		wait_while_hidden();
 	} else while (run) {
-		update_cursor_position();
-		for (auto d : dragons) d->move();
+		simulate();
 		if (!run) break;	// Conditionally selected.
-		draw_dragons();
+		publish_snapshot();
 		if (!run) break;	// Conditionally selected.
-		this_thread::sleep_for(chrono::milliseconds(RefreshRate));
+		this_thread::sleep_for(step_period);
+		wait_while_hidden();
 	}
 
 	return;
 }
 
-void spawn() {
+chrono::seconds next_spawn_interval() {
 	static const chrono::seconds
-		MinSpawnInterval = chrono::seconds(4),
-		MaxSpawnInterval = chrono::seconds(15),
-		SpawnTimeResolution = chrono::seconds(1)
+		MinSpawnInterval = chrono::seconds(stress ? 1 : 4),
+		MaxSpawnInterval = chrono::seconds(stress ? 3 : 15)
 	;
-	random_device rd;			// Obtain a random number from hardware.
-	mt19937 gen(rd());			// Seed generator.
-	uniform_int_distribution<short> distr(	// Define range.
+	static random_device rd;		// Obtain a random number from hardware.
+	static mt19937 gen(rd());		// Seed generator.
+	static uniform_int_distribution<short> distr(	// Define range.
 		MinSpawnInterval.count(),
 		MaxSpawnInterval.count()
 	);
-	chrono::seconds sleep_duration = chrono::seconds(0);
-	while (run) {
-		if (
-			dragons.size() < MaxDragons
-			&& chrono::duration_cast<chrono::seconds>(sleep_duration -= SpawnTimeResolution).count() <= 0
-		) {
-			dragons.push_back(dragon(new Animation()));
-			if (animate_thread.get_id() == thread().get_id()) animate_thread = thread(animate);
-			sleep_duration = chrono::seconds(distr(gen));
+	const auto interval = chrono::seconds(distr(gen));
+	return governor.tier() >= QualityGovernor::ThrottledSpawns ? 2 * interval : interval;
+}
+
+void spawn_dragons(chrono::steady_clock::time_point now) {
+	for (uint_fast16_t i = 0; i < SpawnBurst && dragons.size() < MaxDragons; i++) {
+		dragon d = pool.acquire();
+		if (!d) break;	// Pool is topped up by top_up_pool().
+		d->reset(now);
+		timers.schedule(steps_in(Animation::maturing_resolution), TimedEvent{TimedEvent::Age, d, d->life()});
+		dragons.push_back(d);
+		alive++;
+		metrics.spawned.add();
+	}
+}
+
+void top_up_pool() {
+	// Called between spawns, so server round trips don't coincide with a burst.
+	if (run && pool.available() < SpawnBurst && pool.capacity() < MaxDragons) {
+		const size_t slots = min<size_t>(MaxDragons, pool.capacity() + PoolBatch);
+		backend->reserve_slots(slots);	// First, so no slot is ever drawn without its resources.
+		for (auto &o : screen_outputs) o.backend->reserve_slots(slots);
+		pool.reserve(slots);
+	}
+}
+
+void fire_timer(const TimedEvent &e, chrono::steady_clock::time_point now) {
+	switch (e.kind) {
+		case TimedEvent::Age: {
+			if (e.d->life() != e.life || e.d->dead()) break;	// Killed (and maybe respawned) since.
+			e.d->grow(now);
+			if (!e.d->fully_mature) timers.schedule(steps_in(Animation::maturing_resolution), e);
+			break;
+		}
+		case TimedEvent::Spawn: {
+			spawn_dragons(now);
+			timers.schedule(steps_in(next_spawn_interval()), e);
+			if (top_up_on_spawn) top_up_pool();
+			break;
 		}
-		this_thread::sleep_for(SpawnTimeResolution);
 	}
 }
 
-void event_loop(xcb_connection_t *connection) {
+void spawn() {
+	// Starts the simulation with the first burst. Later bursts are simulation timers, so this only keeps the pool topped up.
+	static const chrono::seconds PoolCheckInterval = chrono::seconds(1);
+	if (animate_thread.get_id() == thread().get_id()) {
+		spawn_dragons(chrono::steady_clock::now());
+		timers.schedule(steps_in(next_spawn_interval()), TimedEvent{TimedEvent::Spawn, nullptr, 0});
+		animate_thread = thread(animate);
+		render_thread = thread(render);
+		for (auto &o : screen_outputs) o.render_thread = thread(render_screen, &o);
+	}
+	while (run) {
+		top_up_pool();
+		// Shutdown notifies unhidden too, so quitting is never held up by the interval.
+		unique_lock<mutex> lock(hidden_mutex);
+		unhidden.wait_for(lock, PoolCheckInterval, []{return !run;});
+		unhidden.wait(lock, []{return !hidden || !run;});
+	}
+}
+
+void update_hidden() {
+	const bool now_hidden = screen_saver_on || obscured_windows.size() == 1 + screen_outputs.size();
+	if (now_hidden == hidden) return;
+	{
+		lock_guard<mutex> lock(hidden_mutex);
+		hidden = now_hidden;
+	}
+	metrics.hidden.set(now_hidden);
+	if (!now_hidden) unhidden.notify_all();
+}
+
+void note_visible(xcb_window_t window) {
+	// Input or exposure means the window is on screen, whatever was last reported.
+	obscured_windows.erase(remove(obscured_windows.begin(), obscured_windows.end(), window), obscured_windows.end());
+	screen_saver_on = false;
+	update_hidden();
+}
+
+bool handle_event(xcb_generic_event_t *gen_e, xcb_key_symbols_t *syms) {
+	// Returns false when the program should stop.
 	int16_t x, y;
-	
-	xcb_generic_event_t *gen_e;
-	xcb_key_symbols_t *syms = xcb_key_symbols_alloc(connection);
-	while (run && (gen_e = xcb_wait_for_event(connection))) {
-		switch (gen_e->response_type & ~0x80) {
-			case XCB_BUTTON_PRESS: {
-				xcb_change_window_attributes(conn,	// Set targeting cursor (while button is held).
-					win,
+
+	if (use_live_background && live_background.handle_event(gen_e)) return run;
+
+	if (screen_saver_event && (gen_e->response_type & ~0x80) == screen_saver_event) {
+		screen_saver_on = ((xcb_screensaver_notify_event_t *)gen_e)->state == XCB_SCREENSAVER_STATE_ON;
+		update_hidden();
+		return run;
+	}
+
+	switch (gen_e->response_type & ~0x80) {
+		case XCB_VISIBILITY_NOTIFY: {
+			xcb_visibility_notify_event_t *spec_e = (xcb_visibility_notify_event_t *)gen_e;
+			obscured_windows.erase(remove(obscured_windows.begin(), obscured_windows.end(), spec_e->window), obscured_windows.end());
+			if (spec_e->state == XCB_VISIBILITY_FULLY_OBSCURED) obscured_windows.push_back(spec_e->window);
+			update_hidden();
+			break;
+		}
+		case XCB_BUTTON_PRESS: {
+			const xcb_window_t window = ((xcb_button_press_event_t *)gen_e)->event;
+			note_visible(window);
+			// Glyph cursors work on any screen, but the animated one was made for the main screen.
+			const uint32_t cursor = window == win ? targeting_cursor.load() : crosshair_cursor;
+			xcb_change_window_attributes(conn,	// Set targeting cursor (while button is held).
+				window,
+				XCB_CW_CURSOR,
+				&cursor
+			);
+			break;
+		}
+		case XCB_BUTTON_RELEASE: {
+			xcb_button_release_event_t *spec_e = (xcb_button_release_event_t *)gen_e;
+			const auto received = chrono::steady_clock::now();
+			x=spec_e->event_x;
+			y=spec_e->event_y;
+
+			// Test against the last frame drawn, which is what the user aimed at, rather than dragons the simulation has moved since.
+			TripleBuffer<FrameSnapshot> *presented = &presented_snapshots;
+			for (auto &o : screen_outputs) if (o.window == spec_e->event) presented = &o.presented;
+			presented->update();
+			// Only the topmost dragon is hit. No multi-kills.
+			if (const DragonSnapshot *d = hit_test(presented->front(), Position{x, y}, hit_masks, ClickTolerance)) {
+				if (d->owner->kill(d->life, received)) {
+					metrics.killed.add();
+					if (--alive == 0) run = false; // Handle in event loop so there is no race condition.
+				}
+			}
+
+			{	// Set default cursor.
+				auto tmp = XCB_CURSOR_NONE;
+				xcb_change_window_attributes(conn,
+					spec_e->event,
 					XCB_CW_CURSOR,
-					&targeting_cursor
+					&tmp
 				);
-				break;
 			}
-			case XCB_BUTTON_RELEASE: {
-				xcb_button_release_event_t *spec_e = (xcb_button_release_event_t *)gen_e;
-				x=spec_e->event_x;
-				y=spec_e->event_y;
-
-				for (auto d : dragons) {
-					if (!point_within_area((Position){x, y}, d->area)) continue;
-					d->dead = true;
-					if (dragons.size() <= 1) run = false; // Handle in event loop so there is no race condition.
-					break;	// No multi-kills.
-				}
-
-				{	// Set default cursor.
-					auto tmp = XCB_CURSOR_NONE;
-					xcb_change_window_attributes(conn,
-						win,
-						XCB_CW_CURSOR,
-						&tmp
-					);
-				}
 
-				break;
+			break;
+		}
+		case XCB_KEY_PRESS: {
+			xcb_key_press_event_t *spec_e = (xcb_key_press_event_t *)gen_e;
+			note_visible(spec_e->event);
+			xcb_keysym_t val = xcb_key_press_lookup_keysym(syms, spec_e, 0);
+			if (val == 'q') {	// Accept 'q' to quit.
+				run = false;
+				return false;
 			}
-			case XCB_KEY_PRESS: {
-				xcb_key_press_event_t *spec_e = (xcb_key_press_event_t *)gen_e;
-				xcb_keysym_t val = xcb_key_press_lookup_keysym(syms, spec_e, 0);
-				if (val == 'q') {	// Accept 'q' to quit.
-					run = false;
-					free(gen_e);			// Not sure if useful.
-					xcb_key_symbols_free(syms);	// Not sure if useful.
-					if (win_geom) free(win_geom);	// Probably always assigned.
-					return;
-				}
-				break;
+			break;
+		}
+		case XCB_EXPOSE: {
+			note_visible(((xcb_expose_event_t *)gen_e)->window);
+			if (((xcb_expose_event_t *)gen_e)->window != win) break;	// Other screens have a fixed size.
+			if (win_geom) free(win_geom);
+			win_geom = xcb_get_geometry_reply(conn,
+				xcb_get_geometry(conn, win),
+				NULL
+			);
+			if (!win_geom) {
+				cerr << "Failed to get window geometry." << endl;
+				run = false;
+				return false;
 			}
-			case XCB_EXPOSE: {
-				if (win_geom) free(win_geom);
-				win_geom = xcb_get_geometry_reply(conn,
-					xcb_get_geometry(conn, win),
-					NULL
-				);
-				if (!win_geom) {
-					cerr << "Failed to get window geometry." << endl;
-					run = false;
-					xcb_key_symbols_free(syms);
-					return;
+
+			win_area = {
+				.origin = {
+					.x = win_geom->x,
+					.y = win_geom->y
+				},
+				// Note: This probably doesn't account for right and bottom window borders.
+				.width = win_geom->width,
+				.height = win_geom->height,
+				.center = {
+					win_geom->x + (win_geom->width/2),
+					win_geom->y + (win_geom->height/2)
 				}
+			};
+			if (!screen_outputs.empty()) {	// Extend across the other screens, to the right.
+				const ScreenOutput &last = screen_outputs.back();
+				win_area.width = last.x + last.width - win_area.origin.x;
+				// Only as tall as the shortest screen, so dragons never fly below one where they can't be seen or clicked.
+				for (auto &o : screen_outputs) win_area.height = min<Distance>(win_area.height, o.height);
+				win_area.center = {win_area.origin.x + win_area.width/2, win_area.origin.y + win_area.height/2};
+			}
+			break;
+		}
+	}
+	return run;
+}
 
-				win_area = {
-					.origin = {
-						.x = win_geom->x,
-						.y = win_geom->y
-					},
-					// Note: This probably doesn't account for right and bottom window borders.
-					.width = win_geom->width,
-					.height = win_geom->height,
-					.center = {
-						win_geom->x + (win_geom->width/2),
-						win_geom->y + (win_geom->height/2)
-					}
-				};
+bool main_window_exposed(const xcb_generic_event_t *gen_e) {
+	return (gen_e->response_type & ~0x80) == XCB_EXPOSE && ((const xcb_expose_event_t *)gen_e)->window == win;
+}
+
+void event_loop(xcb_connection_t *connection) {
+	xcb_generic_event_t *gen_e;
+	xcb_key_symbols_t *syms = xcb_key_symbols_alloc(connection);
+	while (run && (gen_e = xcb_wait_for_event(connection))) {
+		const bool main_exposed = main_window_exposed(gen_e);
+		const bool keep_running = handle_event(gen_e, syms);
+		free(gen_e);
+		if (!keep_running) break;
+
+		// Spawning starts with the first expose and runs until quitting. Later exposes only resume it, through note_visible().
+		if (main_exposed && !spawn_thread.joinable()) spawn_thread = thread(spawn);
+	}
+	xcb_key_symbols_free(syms);
+	if (win_geom) free(win_geom);
+	return;
+}
+
+
+//
+// Reactor mode: a single thread waits on the X connection and timers together.
+//
 
-				if (spawn_thread.get_id() != thread().get_id()) spawn_thread.join();
-				spawn_thread = thread(spawn);
+bool arm_timer(int fd, chrono::nanoseconds initial, chrono::nanoseconds interval = chrono::nanoseconds(0)) {
+	// A zero initial value would disarm the timer, so expire as soon as possible instead.
+	if (initial.count() <= 0) initial = chrono::nanoseconds(1);
+	const itimerspec spec = {
+		.it_interval = {
+			.tv_sec = (time_t)chrono::duration_cast<chrono::seconds>(interval).count(),
+			.tv_nsec = (long)(interval % chrono::seconds(1)).count()
+		},
+		.it_value = {
+			.tv_sec = (time_t)chrono::duration_cast<chrono::seconds>(initial).count(),
+			.tv_nsec = (long)(initial % chrono::seconds(1)).count()
+		}
+	};
+	if (timerfd_settime(fd, 0, &spec, NULL)) {
+		perror("Failed to arm timer");
+		return false;
+	}
+	return true;
+}
+void disarm_timer(int fd) {
+	const itimerspec spec = {};
+	timerfd_settime(fd, 0, &spec, NULL);
+}
+bool timer_is_armed(int fd) {
+	itimerspec spec;
+	if (timerfd_gettime(fd, &spec)) return false;
+	return spec.it_value.tv_sec || spec.it_value.tv_nsec;
+}
+
+void reactor_loop(xcb_connection_t *connection) {
+	// Frame ticks and the first spawn are timerfds polled alongside the X connection. Later spawns and aging are simulation timers.
+	// Everything runs on this thread, so no state is shared and shutdown is immediate.
+	// While hidden, the frame timer is stopped, so nothing wakes the thread but events.
+	top_up_on_spawn = true;
+	bool started = false;	// The first spawn has happened, and frames are ticking unless hidden.
+
+	const int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	const int x_fd = xcb_get_file_descriptor(connection);
+	const int frame_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	const int spawn_timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (epoll_fd < 0 || frame_timer < 0 || spawn_timer < 0) {
+		perror("Failed to create reactor");
+		run = false;
+	}
+	for (int fd : {x_fd, frame_timer, spawn_timer}) {
+		if (!run) break;
+		epoll_event ev = {
+			.events = EPOLLIN,
+			.data = {.fd = fd}
+		};
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev)) {
+			perror("Failed to register reactor source");
+			run = false;
+		}
+	}
 
-				break;
+	xcb_generic_event_t *gen_e;
+	xcb_key_symbols_t *syms = xcb_key_symbols_alloc(connection);
+	epoll_event ready[3];
+	while (run) {
+		// Handle events xcb has already read from the socket. Polling the descriptor would not report them.
+		while (run && (gen_e = xcb_poll_for_event(connection))) {
+			const bool main_exposed = main_window_exposed(gen_e);
+			handle_event(gen_e, syms);
+			free(gen_e);
+			if (main_exposed && !started && !timer_is_armed(spawn_timer)) arm_timer(spawn_timer, chrono::seconds(0));
+		}
+		if (!run) break;
+		if (started && hidden == timer_is_armed(frame_timer)) {
+			if (hidden) disarm_timer(frame_timer);
+			else arm_timer(frame_timer, chrono::seconds(0), step_period);	// Resume straight away.
+		}
+		if (xcb_connection_has_error(connection)) {
+			fprintf(stderr, "X connection failed.\n");
+			break;
+		}
+		xcb_flush(connection);
+
+		const int ready_ct = epoll_wait(epoll_fd, ready, 3, -1);
+		if (ready_ct < 0) {
+			if (errno == EINTR) continue;
+			perror("Failed to wait for reactor sources");
+			break;
+		}
+		for (int i = 0; i < ready_ct && run; i++) {
+			const int fd = ready[i].data.fd;
+			if (fd == x_fd) continue;	// Events are handled at the top of the loop.
+
+			uint64_t expirations;
+			if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations)) continue;
+
+			if (fd == frame_timer) {
+				// Missed ticks are dropped rather than simulated back to back.
+				simulate();
+				publish_snapshot();
+				if (render_snapshots.update()) draw_dragons(render_snapshots.front());
+				for (auto &o : screen_outputs) if (o.snapshots.update()) draw_screen(o, o.snapshots.front());
+				finish_frame();	// Before waiting for the next tick, as render() does.
+			} else if (fd == spawn_timer) {
+				spawn_dragons(chrono::steady_clock::now());
+				timers.schedule(steps_in(next_spawn_interval()), TimedEvent{TimedEvent::Spawn, nullptr, 0});
+				arm_timer(frame_timer, step_period, step_period);
+				started = true;
+				top_up_pool();
 			}
 		}
-		free (gen_e);
 	}
+
 	xcb_key_symbols_free(syms);
 	if (win_geom) free(win_geom);
+	for (int fd : {frame_timer, spawn_timer, epoll_fd}) if (fd >= 0) close(fd);
 	return;
 }
 
+xcb_connection_t *open_connection(const char *purpose) {
+	// Another connection to the same display, or conn itself if one can't be opened.
+	if (!separate_connections) return conn;
+	xcb_connection_t *c = xcb_connect(NULL, NULL);
+	if (xcb_connection_has_error(c)) {
+		fprintf(stderr, "Warning: failed to open a connection for %s. Sharing the main one.\n", purpose);
+		xcb_disconnect(c);
+		return conn;
+	}
+	return c;
+}
+
+void hand_over(xcb_connection_t *from, xcb_connection_t *to) {
+	// Requests sent on to after this are processed after those already sent on from, even unchecked ones.
+	// A SYNC fence triggered by from is awaited by to, so the server orders them and from is never waited on.
+	if (from == to) return;
+	if (xcb_get_extension_data(to, &xcb_sync_id)->present) {
+		// Created and checked on to first, so it exists before from triggers it.
+		const xcb_sync_fence_t fence = xcb_generate_id(to);
+		xcb_discard_reply(to, xcb_sync_initialize(to, XCB_SYNC_MAJOR_VERSION, XCB_SYNC_MINOR_VERSION).sequence);
+		xcb_generic_error_t *fence_err = xcb_request_check(to, xcb_sync_create_fence_checked(to, screen->root, fence, false));
+		if (!fence_err) {
+			xcb_sync_trigger_fence(from, fence);
+			xcb_flush(from);
+			xcb_sync_await_fence(to, 1, &fence);
+			xcb_sync_destroy_fence(to, fence);
+			return;
+		}
+		free(fence_err);
+	}
+	// Without fences, wait for from to catch up instead.
+	free(xcb_get_input_focus_reply(from, xcb_get_input_focus(from), NULL));
+}
+
+unique_ptr<RenderBackend> make_backend(xcb_window_t window, xcb_gcontext_t window_gc, uint16_t width, uint16_t height, xcb_drawable_t background) {
+	// Background is XCB_NONE with a system compositor. If the software backend fails, this and later windows use XRender.
+	if (backend_kind == Software) {
+		auto software = make_unique<SoftwareBackend>();
+		if (!use_cache) software->cache_dir.clear();
+		if (software->init(render_conn,
+			window,
+			window_gc,
+			width,
+			height,
+			background
+		)) {
+			return software;
+		} else {
+			fprintf(stderr, "Falling back on XRender compositing.\n");
+			backend_kind = XRender;
+		}
+	}
+	if (backend_kind == XRender) {
+		auto xrender = make_unique<XRenderBackend>();
+		if (!use_cache) xrender->cache_dir.clear();
+		xrender->sprite_budget = sprite_budget;
+		if (xrender->init(render_conn,
+			window,
+			window_gc,
+			pfi.id,
+			width,
+			height,
+			background
+		)) {
+			return xrender;
+		}
+	} else if (backend_kind == Null) {
+		return make_unique<NullBackend>();
+	}
+	return nullptr;
+}
+
+bool open_screen_output(ScreenOutput &o, xcb_screen_t *s, int screen_number, Distance x, bool use_overlay) {
+	// Like the main window, but on another screen, and without focus or a cursor of its own. Needs the frames loaded.
+	o.screen = s;
+	o.x = x;
+	o.width = s->width_in_pixels;
+	o.height = s->height_in_pixels;
+	const xcb_visualtype_t *v = find_argb_visual(s);
+	if (!v) {
+		fprintf(stderr, "Failed to get visual for screen %d.\n", screen_number);
+		return false;
+	}
+
+	char atom_name[24];
+	snprintf(atom_name, sizeof(atom_name), "_NET_WM_CM_S%d", screen_number);
+	const auto atom_cookie = xcb_intern_atom(conn, true, strlen(atom_name), atom_name);
+	xcb_composite_get_overlay_window_cookie_t cowc;
+	if (use_overlay) cowc = xcb_composite_get_overlay_window(conn, s->root);
+	o.cmap = xcb_generate_id(conn);
+	const auto cmap_cookie = xcb_create_colormap_checked(conn,
+		XCB_COLORMAP_ALLOC_NONE,
+		o.cmap,
+		s->root,
+		v->visual_id
+	);
+	const bool composited = supports_transparency(atom_cookie, atom_name);
+	xcb_window_t parent = s->root;
+	if (use_overlay) {
+		auto *cowr = xcb_composite_get_overlay_window_reply(conn, cowc, &err);
+		if (!cowr) {
+			fprintf(stderr, "Failed to get overlay window for screen %d.\n", screen_number);
+			return false;
+		}
+		parent = cowr->overlay_win;
+		free(cowr);
+	}
+	if ((err = xcb_request_check(conn, cmap_cookie))) {
+		fprintf(stderr, "Failed to create colormap for screen %d.\n", screen_number);
+		free(err);
+		return false;
+	}
+
+	// Override-redirect, so a window manager neither moves nor decorates it. Without a compositor there is no background,
+	// so the desktop below can be copied once the window is mapped.
+	const uint32_t value_mask =
+		(composited ? XCB_CW_BACK_PIXEL : 0)
+		| XCB_CW_BORDER_PIXEL
+		| XCB_CW_OVERRIDE_REDIRECT
+		| XCB_CW_EVENT_MASK
+		| XCB_CW_COLORMAP
+	;
+	vector<uint32_t> values;
+	if (composited) values.push_back(0);
+	values.push_back(0);
+	values.push_back(true);
+	values.push_back(
+		XCB_EVENT_MASK_KEY_PRESS
+		| XCB_EVENT_MASK_BUTTON_PRESS
+		| XCB_EVENT_MASK_BUTTON_RELEASE
+		| XCB_EVENT_MASK_VISIBILITY_CHANGE
+	);
+	values.push_back(o.cmap);
+	o.window = xcb_generate_id(conn);
+	const auto window_cookie = xcb_create_window_checked(conn,
+		32,			// Depth.
+		o.window,
+		parent,
+		0, 0,			// x, y.
+		o.width, o.height,
+		0,			// Border width.
+		XCB_WINDOW_CLASS_INPUT_OUTPUT,
+		v->visual_id,
+		value_mask, values.data()
+	);
+	const auto map_cookie = xcb_map_window_checked(conn, o.window);
+	const uint32_t gc_values[3] = {s->black_pixel, s->white_pixel, false};
+	o.gc = xcb_generate_id(conn);
+	const auto gc_cookie = xcb_create_gc_checked(conn,
+		o.gc,
+		o.window,
+		XCB_GC_FOREGROUND | XCB_GC_BACKGROUND | XCB_GC_GRAPHICS_EXPOSURES,
+		gc_values
+	);
+	bool failed = false;
+	for (auto [c, failure] : {
+		pair{window_cookie, "Failed to create window"},
+		pair{map_cookie, "Failed to map window"},
+		pair{gc_cookie, "Failed to create graphical context"}
+	}) {
+		if ((err = xcb_request_check(conn, c))) {
+			fprintf(stderr, "%s for screen %d.\n", failure, screen_number);
+			free(err);
+			failed = true;
+		}
+	}
+	if (failed) return false;
+
+	o.background = XCB_NONE;
+	if (!composited) {
+		o.background = xcb_generate_id(conn);
+		xcb_create_pixmap(conn, 32, o.background, o.window, o.width, o.height);
+		xcb_copy_area(conn, o.window, o.background, o.gc, 0, 0, 0, 0, o.width, o.height);
+	}
+	hand_over(conn, render_conn);	// The window and background are used for drawing from here on.
+	o.backend = make_backend(o.window, o.gc, o.width, o.height, o.background);
+	if (!o.backend || !o.backend->upload_frames(frame_images)) {
+		fprintf(stderr, "Failed to set up render backend for screen %d.\n", screen_number);
+		return false;
+	}
+	return true;
+}
+
+bool parse_whole(const char *text, unsigned long min, unsigned long max, unsigned long *out) {
+	// Digits only: strtoul also skips spaces and takes a sign, wrapping negative numbers around.
+	if (!isdigit((unsigned char)*text)) return false;
+	char *end;
+	errno = 0;
+	const unsigned long n = strtoul(text, &end, 10);
+	if (*end || errno || n < min || n > max) return false;
+	*out = n;
+	return true;
+}
+
 int main(int argc, char *argv[]) {
 	unsigned short errors = 0;
 
 
 	// Parse C.L.I. parameters:
 	bool use_overlay = true;	// Disable overlay when debugging!
-	if (argc > 1) {
-		if (!strcmp(argv[1], "--no-overlay")) use_overlay = false;
+	bool use_reactor = false;
+	long frame_budget_ms = -1;	// Until given, a share of the step period.
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--no-overlay")) use_overlay = false;
+		else if (!strcmp(argv[i], "--stress")) stress = true;
+		else if (!strncmp(argv[i], "--stress=", 9)) {
+			stress = true;
+			unsigned long dragons;
+			if (!parse_whole(argv[i] + 9, 1, UINT32_MAX, &dragons)) {
+				fprintf(stderr, "Dragon count must be a whole number, at least 1.\n");
+				return 1;
+			}
+			StressMaxDragons = dragons;
+		}
+		else if (!strcmp(argv[i], "--reactor")) use_reactor = true;
+		else if (!strcmp(argv[i], "--software")) backend_kind = Software;
+		else if (!strncmp(argv[i], "--backend=", 10)) {
+			const char *name = argv[i] + 10;
+			if (!strcmp(name, "xrender")) backend_kind = XRender;
+			else if (!strcmp(name, "software")) backend_kind = Software;
+			else if (!strcmp(name, "null")) backend_kind = Null;
+			else {
+				fprintf(stderr, "Unknown render backend: \"%s\"\n", name);
+				return 1;
+			}
+		}
+		else if (!strncmp(argv[i], "--record=", 9)) record_path = argv[i] + 9;
+		else if (!strcmp(argv[i], "--no-cache")) use_cache = false;
+		else if (!strncmp(argv[i], "--sprite-budget=", 16)) {
+			unsigned long mib;
+			if (!parse_whole(argv[i] + 16, 0, MaxSpriteBudget, &mib)) {
+				fprintf(stderr, "Sprite budget must be a whole number of MiB, from 0 to %lu.\n", MaxSpriteBudget);
+				return 1;
+			}
+			sprite_budget = (size_t)mib << 20;
+		}
+		else if (!strncmp(argv[i], "--frame-budget=", 15)) {
+			unsigned long ms;
+			if (!parse_whole(argv[i] + 15, 0, 60000, &ms)) {
+				fprintf(stderr, "Frame budget must be a whole number of milliseconds, from 0 to 60000.\n");
+				return 1;
+			}
+			frame_budget_ms = ms;
+		}
+		else if (!strncmp(argv[i], "--step-rate=", 12)) {
+			unsigned long hz;
+			if (!parse_whole(argv[i] + 12, 1, MaxStepRate, &hz)) {
+				fprintf(stderr, "Step rate must be a whole number of Hz, from 1 to %lu.\n", MaxStepRate);
+				return 1;
+			}
+			step_period = chrono::nanoseconds(chrono::seconds(1)) / hz;
+		}
+		else if (!strcmp(argv[i], "--shape")) use_shape = true;
+		else if (!strcmp(argv[i], "--all-screens")) all_screens = true;
+		else if (!strcmp(argv[i], "--shared-connection")) separate_connections = false;
+		else if (!strcmp(argv[i], "--live-background")) use_live_background = true;
+		else if (!strncmp(argv[i], "--metrics-socket=", 17)) metrics_socket = argv[i] + 17;
 		else {
-			fprintf(stderr, "Unknown command-line parameter(s).\n");
+			fprintf(stderr, "Unknown command-line parameter: \"%s\"\n", argv[i]);
 			return 1;
 		}
 	}
+	// Leaves the rest of each frame to the simulation and the server.
+	governor.budget = frame_budget_ms < 0 ? chrono::duration_cast<chrono::microseconds>(step_period / 3) : chrono::milliseconds(frame_budget_ms);
+	Animation::step_scale = step_period.count() * FixedOne / chrono::nanoseconds(BaseStep).count();
+	if (stress) {
+		MaxDragons = StressMaxDragons;
+		SpawnBurst = StressSpawnBurst;
+	}
+	simulation_seed = random_device()();
+	spark_rng.seed(simulation_seed);
 
 
 	// Initialise connection:
 	int screenNum;				// Assigned by xcb_connect().
 	conn = xcb_connect(NULL, &screenNum);	// NULL uses DISPLAY env.
 	const xcb_setup_t *setup = xcb_get_setup(conn);
+	if (use_reactor) separate_connections = false;	// Everything is on one thread anyway.
+	render_conn = open_connection("drawing");
+	resource_conn = open_connection("building resources");
+
+	// The first request of each extension would otherwise wait for the server to describe the extension.
+	// Each connection keeps its own copy of these.
+	xcb_prefetch_extension_data(conn, &xcb_composite_id);
+	xcb_prefetch_extension_data(conn, &xcb_render_id);
+	if (use_live_background) xcb_prefetch_extension_data(conn, &xcb_damage_id);
+	xcb_prefetch_extension_data(conn, &xcb_screensaver_id);
+	xcb_prefetch_extension_data(render_conn, &xcb_render_id);
+	xcb_prefetch_extension_data(render_conn, &xcb_sync_id);
+	if (use_shape) xcb_prefetch_extension_data(render_conn, &xcb_shape_id);
+	if (backend_kind == Software) xcb_prefetch_extension_data(render_conn, &xcb_shm_id);
+	xcb_prefetch_extension_data(resource_conn, &xcb_render_id);
 
 
 	// Get screen with corresponding number:
@@ -476,33 +1440,7 @@ int main(int argc, char *argv[]) {
 	screen = iter.data;
 
 
-	xcb_composite_get_overlay_window_reply_t *cowr = nullptr;
-	if (use_overlay) {
-		// Get overlay window:
-		xcb_composite_get_overlay_window_cookie_t cowc =
-			xcb_composite_get_overlay_window(conn, screen->root)
-		;
-		cowr = xcb_composite_get_overlay_window_reply(conn, cowc, &err)
-		;
-		if (!cowr) return 1;
-		overlay = cowr->overlay_win;
-	}
-
-
-	{	// Get 32-bit visual for screen:
-		xcb_depth_iterator_t depth_iter;
-		depth_iter = xcb_screen_allowed_depths_iterator (screen);
-		for (; depth_iter.rem; xcb_depth_next (&depth_iter)) {
-			xcb_visualtype_iterator_t visual_iter;
-
-			visual_iter = xcb_depth_visuals_iterator (depth_iter.data);
-			for (; visual_iter.rem; xcb_visualtype_next (&visual_iter)) {
-				if (visual_iter.data->_class == 4) {
-					visual = visual_iter.data;
-				}
-			}
-		}
-	}
+	visual = find_argb_visual(screen);
 	if (!visual) {
 		fprintf(stderr, "Failed to get visual.\n");
 		return 1;
@@ -510,25 +1448,54 @@ int main(int argc, char *argv[]) {
 
 
 	//
-	// Create a window:
+	// Issue independent requests together, then collect the replies:
 	//
 
+	xcb_composite_get_overlay_window_cookie_t cowc;
+	if (use_overlay) cowc = xcb_composite_get_overlay_window(conn, screen->root);
+	const auto atom_cookie = xcb_intern_atom(conn,
+		true,		// only_if_exists (do not create).
+		14,		// Name length.
+		"_NET_WM_CM_S0"	// Name.
+	);
+	const auto formats_cookie = xcb_render_query_pict_formats(conn);
 	cmap = xcb_generate_id(conn);
-	xcb_create_colormap_checked(conn,
+	const auto cmap_cookie = xcb_create_colormap_checked(conn,
 		XCB_COLORMAP_ALLOC_NONE,
 		cmap,
 		screen->root,
 		visual->visual_id
 	);
-	if ((err = xcb_request_check(conn, cookie))) {
+
+	xcb_composite_get_overlay_window_reply_t *cowr = nullptr;
+	if (use_overlay) {
+		// Get overlay window:
+		cowr = xcb_composite_get_overlay_window_reply(conn, cowc, &err);
+		if (!cowr) return 1;
+		overlay = cowr->overlay_win;
+	}
+	has_system_compositor = supports_transparency(atom_cookie, "_NET_WM_CM_S0");
+	bool found_pfi;
+	if (! (found_pfi = get_picture_format(formats_cookie))) {
+		fprintf(stderr, "Failed to query picture formats.\n");
+		errors++;
+	}
+	if ((err = xcb_request_check(conn, cmap_cookie))) {
 		fprintf(stderr, "Failed to create colormap.\n");
+		free(err);
 		errors++;
 	}
 
+
+	//
+	// Create a window, its graphical context, and a placeholder cursor. Checked together.
+	//
+
+	xcb_void_cookie_t window_cookie, map_cookie, focus_cookie, gc_cookie;
 	{
 		uint32_t value_mask;
 		vector<uint32_t> values;
-		if ((has_system_compositor = supports_transparency())) {
+		if (has_system_compositor) {
 			value_mask =
 				XCB_CW_BACK_PIXEL
 				| XCB_CW_BORDER_PIXEL
@@ -543,6 +1510,7 @@ int main(int argc, char *argv[]) {
 				| XCB_EVENT_MASK_BUTTON_RELEASE
 				| XCB_EVENT_MASK_BUTTON_1_MOTION
 				| XCB_EVENT_MASK_EXPOSURE
+				| XCB_EVENT_MASK_VISIBILITY_CHANGE
 			);
 			values.push_back(cmap);
 		} else {
@@ -569,6 +1537,7 @@ int main(int argc, char *argv[]) {
 				| XCB_EVENT_MASK_BUTTON_RELEASE
 				| XCB_EVENT_MASK_BUTTON_1_MOTION
 				| XCB_EVENT_MASK_EXPOSURE
+				| XCB_EVENT_MASK_VISIBILITY_CHANGE
 			);
 			values.push_back(cmap);
 		}
@@ -579,7 +1548,7 @@ int main(int argc, char *argv[]) {
 		values.clear();
 
 		win = xcb_generate_id(conn);
-		xcb_create_window_checked(conn,
+		window_cookie = xcb_create_window_checked(conn,
 			32,			// Depth.
 			win,			// I.D.
 			(use_overlay ? overlay : screen->root),		// Parent window.
@@ -591,29 +1560,14 @@ int main(int argc, char *argv[]) {
 			visual->visual_id,
 			value_mask, value_list
 		);
-		if ((err = xcb_request_check(conn, cookie))) {
-			fprintf(stderr, "Failed to create window.\n");
-			errors++;
-		}
-		xcb_map_window_checked(conn, win);
-		if ((err = xcb_request_check(conn, cookie))) {
-			fprintf(stderr, "Failed to map window.\n");
-			errors++;
-		}
-		xcb_set_input_focus_checked(conn,
+		map_cookie = xcb_map_window_checked(conn, win);
+		focus_cookie = xcb_set_input_focus_checked(conn,
 			XCB_INPUT_FOCUS_POINTER_ROOT,	// "revert_to".
 			win,				// Window to focus.
 			XCB_CURRENT_TIME		// Timestamp to avoid race conditions.
 		);
-		if ((err = xcb_request_check(conn, cookie))) {
-			fprintf(stderr, "Failed to set input focus.\n");
-			errors++;
-		}
-
-		xcb_flush(conn);
 	}
 
-
 	{	// Create graphical context for window:
 		uint32_t value_mask =
 			XCB_GC_FOREGROUND
@@ -626,161 +1580,52 @@ int main(int argc, char *argv[]) {
 			false
 		};
 		gc = xcb_generate_id(conn);
-		cookie = xcb_create_gc_checked(conn, gc, win, value_mask, value_list);
-		if ((err = xcb_request_check(conn, cookie))) {
-			fprintf(stderr, "Failed to create graphical context.\n");
+		gc_cookie = xcb_create_gc_checked(conn, gc, win, value_mask, value_list);
+	}
+
+	// A plain crosshair from the core cursor font is used until the animated cursor has been built.
+	const xcb_void_cookie_t crosshair_cookie = make_crosshair_cursor();
+
+	for (auto [c, failure] : {
+		pair{window_cookie, "Failed to create window.\n"},
+		pair{map_cookie, "Failed to map window.\n"},
+		pair{focus_cookie, "Failed to set input focus.\n"},
+		pair{gc_cookie, "Failed to create graphical context.\n"}
+	}) {
+		if ((err = xcb_request_check(conn, c))) {
+			fprintf(stderr, "%s", failure);
+			free(err);
 			errors++;
 		}
 	}
-
-
-	//
-	// Create cursor:
-	//
-
-	bool found_pfi;
-	if (! (found_pfi = get_picture_format())) {
-		fprintf(stderr, "Failed to query picture formats.\n");
-		errors++;
+	if ((err = xcb_request_check(conn, crosshair_cookie))) {
+		fprintf(stderr, "Failed to create crosshair cursor.\n");
+		free(err);
+		// Not counting error. Cursor is non-critical to application.
 	}
 
-	xcb_gcontext_t cursor_fg = xcb_generate_id(conn);
-	xcb_gcontext_t cursor_transparent = xcb_generate_id(conn);
-	{
-		// Define cursor colour:
-		xcb_alloc_color_reply_t *acr = xcb_alloc_color_reply(conn,
-			xcb_alloc_color(conn,
-				cmap,
-				65535,	// Red.
-				0,	// Green.
-				0	// Blue.
-			),
-			NULL
-		);
-		const uint32_t MakeOpaque = found_pfi ? pfi.direct.alpha_mask << pfi.direct.alpha_shift : 0;
-
-		// Create the cursor's graphical contexts:
-		uint32_t value_mask =
-			XCB_GC_FOREGROUND
-			| XCB_GC_BACKGROUND
-			| XCB_GC_LINE_WIDTH
-			| XCB_GC_CAP_STYLE
-			| XCB_GC_FILL_STYLE
-			| XCB_GC_GRAPHICS_EXPOSURES
-		;
-		uint32_t value_list[6] = {
-			acr->pixel + MakeOpaque,
-			0,
-			2,
-			XCB_CAP_STYLE_ROUND,
-			XCB_FILL_STYLE_SOLID,
-			false
-		};
-		cookie = xcb_create_gc_checked(conn, cursor_fg, win, value_mask, value_list);
-		if ((err = xcb_request_check(conn, cookie))) {
-			fprintf(stderr, "Failed to create graphical context.\n");
-			handle_error(conn, err);
-			// Not counting error. Cursor is non-critical to application.
-		}
-		value_list[0] = 0;	// Transparent.
-		value_list[1] = 0;	// Transparent.
-		cookie = xcb_create_gc_checked(conn, cursor_transparent, win, value_mask, value_list);
-		if ((err = xcb_request_check(conn, cookie))) {
-			fprintf(stderr, "Failed to create graphical context.\n");
-			handle_error(conn, err);
-			// Not counting error. Cursor is non-critical to application.
-		}
+	// Follow the screen saver, to pause while it is on. The initial state is collected once everything is loaded.
+	xcb_screensaver_query_info_cookie_t screen_saver_cookie = {0};
+	if (const auto *ext = xcb_get_extension_data(conn, &xcb_screensaver_id); ext && ext->present) {
+		screen_saver_event = ext->first_event + XCB_SCREENSAVER_NOTIFY;
+		xcb_screensaver_select_input(conn, screen->root, XCB_SCREENSAVER_EVENT_NOTIFY_MASK);
+		screen_saver_cookie = xcb_screensaver_query_info(conn, screen->root);
 	}
-	{
-		const uint_fast8_t CursorSize = 60;
 
-		// Create pixmap:
-		cursor_pixmap = xcb_generate_id(conn);
-		cookie = xcb_create_pixmap_checked(conn,
-			32,	// Depth.
-			cursor_pixmap,
-			win,
-			CursorSize, CursorSize
-		);
-		if ((err = xcb_request_check(conn, cookie))) {
-			fprintf(stderr, "Failed to create pixmap.\n");
-			handle_error(conn, err);
-			// Not counting error. Cursor is non-critical to application.
-		}
-		{	// Draw transparent background into pixmap:
-			if (has_system_compositor) {
-				xcb_clear_area_checked(conn,	// Not sure if this works.
-					false,			// Trigger expose event.
-					cursor_pixmap,
-					0, 0,
-					CursorSize, CursorSize
-				);
-				if ((err = xcb_request_check(conn, cookie))) {
-					fprintf(stderr, "Failed to clear pixmap area.\n");
-					handle_error(conn, err);
-					// Not counting error. Cursor is non-critical to application.
-				}
-			} else {
-				xcb_rectangle_t bg_rectangle = {0, 0, CursorSize, CursorSize};
-				cookie = xcb_poly_fill_rectangle_checked(conn,
-					cursor_pixmap,
-					cursor_transparent,
-					1,
-					&bg_rectangle
-				);
-				if ((err = xcb_request_check(conn, cookie))) {
-					fprintf(stderr, "Failed to draw cursor background.\n");
-					handle_error(conn, err);
-					// Not counting error. Cursor is non-critical to application.
-				}
-			}
-		}
-		{	// Draw targeting cursor into pixmap:
-			xcb_segment_t segments[] = {
-				{	// Vertical.
-					CursorSize/2, 0,
-					CursorSize/2, CursorSize
-				},
-				{	// Horizontal.
-					0, CursorSize/2,
-					CursorSize, CursorSize/2
-				}
-			};
-			cookie = xcb_poly_segment_checked(conn,
-				cursor_pixmap,
-				cursor_fg,
-				2,		// Number of segments.
-				segments
-			);
-			if ((err = xcb_request_check(conn, cookie))) {
-				fprintf(stderr, "Failed to draw cursor lines.\n");
-				handle_error(conn, err);
-				// Not counting error. Cursor is non-critical to application.
-			}
-		}
-		hotspot_pair hotspot = {CursorSize/2, CursorSize/2};
-		if (found_pfi) {
-			cursor_specs_t cursor_specs = {
-				.pixmap = cursor_pixmap,
-				.width = CursorSize,
-				.height = CursorSize,
-				.hotspot = hotspot,
-				.fg = cursor_fg
-			};
-			if (! (targeting_cursor = make_rotating_cursor(&cursor_specs, 0.15, 12))) {
-				fprintf(stderr, "Failed to make rotating cursor.\n");
-			}
-		} else {
-			if (! (targeting_cursor = make_picture_cursor(cursor_pic, hotspot))) {
-				fprintf(stderr, "Failed to make cursor.\n");
-			}
+
+	if (use_shape) {
+		if (!has_system_compositor) {
+			fprintf(stderr, "Warning: --shape requires a system compositor. Ignoring.\n");
+			use_shape = false;
+		} else if (!xcb_get_extension_data(render_conn, &xcb_shape_id)->present) {
+			fprintf(stderr, "Warning: SHAPE extension is not available. Ignoring --shape.\n");
+			use_shape = false;
 		}
 	}
 
 
 	if (!errors) {
-		if (init_pixmaps()) {
-
+		if (load_frames()) {
 			if (!has_system_compositor) {	// Create pixmap of background (for fake transparency).
 				fake_bg = xcb_generate_id(conn);
 				xcb_create_pixmap(conn,
@@ -801,33 +1646,112 @@ int main(int argc, char *argv[]) {
 				);
 			}
 
+			hand_over(conn, render_conn);	// The window and background are used for drawing from here on.
+
+			if (use_live_background) {
+				if (has_system_compositor) {
+					fprintf(stderr, "Warning: --live-background only applies without a system compositor. Ignoring.\n");
+					use_live_background = false;
+				} else if (!live_background.init(conn, render_conn, screen, fake_bg, pfi.id, {win, overlay})) {
+					fprintf(stderr, "Warning: background will not be updated.\n");
+					use_live_background = false;
+				}
+			}
+
+			backend = make_backend(win, gc, screen->width_in_pixels, screen->height_in_pixels, has_system_compositor ? XCB_NONE : fake_bg);
+			if (backend && record_path) backend = make_unique<RecordingBackend>(record_path, move(backend));
+			if (!backend || !backend->upload_frames(frame_images)) {
+				fprintf(stderr, "Failed to set up render backend.\n");
+				run = false;
+			}
+			if (all_screens && run) {
+				// Other screens are laid out left to right after this one, in the order the server lists them.
+				Distance x = screen->width_in_pixels;
+				xcb_screen_iterator_t screens = xcb_setup_roots_iterator(setup);
+				for (int number = 0; screens.rem; number++, xcb_screen_next(&screens)) {
+					if (number == screenNum) continue;
+					ScreenOutput &o = screen_outputs.emplace_back();
+					if (open_screen_output(o, screens.data, number, x, use_overlay)) {
+						x += o.width;
+						continue;
+					}
+					fprintf(stderr, "Warning: leaving out screen %d.\n", number);
+					if (o.backend) o.backend->release();
+					if (o.window) xcb_destroy_window(conn, o.window);
+					screen_outputs.pop_back();
+				}
+				if (screen_outputs.empty()) fprintf(stderr, "Warning: --all-screens found no other screens.\n");
+			}
+			hit_masks.build(frame_images);
+			frame_images.clear();
+
+			// Create dragon slots (and the backend's resources for them) before the first spawn. More are added by the spawn thread as needed.
+			dragons.reserve(MaxDragons);
+			if (backend) backend->reserve_slots(min<size_t>(MaxDragons, PoolBatch));
+			for (auto &o : screen_outputs) o.backend->reserve_slots(min<size_t>(MaxDragons, PoolBatch));
+			pool.reserve(min<size_t>(MaxDragons, PoolBatch));
+
+			if (metrics_socket && !metrics_server.start(metrics_socket)) {
+				fprintf(stderr, "Continuing without metrics socket.\n");
+			}
+
+			if (screen_saver_cookie.sequence) {
+				if (auto *info = xcb_screensaver_query_info_reply(conn, screen_saver_cookie, NULL)) {
+					screen_saver_on = info->state == XCB_SCREENSAVER_STATE_ON;
+					free(info);
+					update_hidden();
+				}
+			}
+
 			xcb_flush(conn);
-			event_loop(conn);	// Keep the program running until user terminates.
+			cursor_thread = thread(build_targeting_cursor, found_pfi);
+			// Keep the program running until user terminates.
+			if (use_reactor) reactor_loop(conn);
+			else event_loop(conn);
 
 			// Make sure all threads have finished, so they don't attempt to access freed data.
-			animate_thread.join();	// Make sure this is finished, so it doesn't attempt to access freed data.
-			//spawn_thread.join();	// This is now below.
+			run = false;	// Also when the loop ended because the connection failed.
+			{lock_guard<mutex> lock(hidden_mutex);}	// As in wake_renderers(), so no thread misses it.
+			unhidden.notify_all();
+			// First, as it starts the others and may be growing the pool. Never started in reactor mode.
+			if (spawn_thread.joinable()) spawn_thread.join();
+			if (animate_thread.joinable()) animate_thread.join();	// Make sure this is finished, so it doesn't attempt to access freed data.
+			wake_renderers();
+			if (render_thread.joinable()) render_thread.join();
+			for (auto &o : screen_outputs) if (o.render_thread.joinable()) o.render_thread.join();
+			metrics_server.stop();
 
 			// Clean up.
 			//xcb_composite_release_overlay_window(conn, screen->root);	// This causes the program to not end. Must be killed from a different TTY.
-			for (auto pix : Animation::pixmaps) xcb_free_pixmap(conn, pix);
+			if (backend) backend->release();
+			for (auto &o : screen_outputs) {
+				o.backend->release();
+				xcb_free_gc(conn, o.gc);
+			}
+			if (use_live_background) live_background.release();
+			pool.clear();
 
 		} else {
-			printf("Failed to init_pixmaps().\n");
+			printf("Failed to load_frames().\n");
 		}
 	}
 
 
 	/* Done. Clean up: */
 
-	xcb_free_pixmap(conn, cursor_pixmap);
-	xcb_free_cursor(conn, targeting_cursor);
+	if (cursor_thread.joinable()) cursor_thread.join();	// Before freeing what it creates.
+	if (cursor_pixmap) xcb_free_pixmap(resource_conn, cursor_pixmap);
+	if (targeting_cursor != crosshair_cursor) xcb_free_cursor(resource_conn, targeting_cursor);
+	if (crosshair_cursor) xcb_free_cursor(conn, crosshair_cursor);
 	if (use_overlay) free(cowr);
 	xcb_free_gc(conn, gc);
-	xcb_free_gc(conn, cursor_fg);
-	xcb_free_gc(conn, cursor_transparent);
+	if (cursor_fg) xcb_free_gc(resource_conn, cursor_fg);
+	if (cursor_transparent) xcb_free_gc(resource_conn, cursor_transparent);
 	//free(err);
+	for (auto c : {render_conn, resource_conn}) if (c != conn) xcb_disconnect(c);
 	xcb_disconnect(conn);
-	spawn_thread.join();	// This is last because it has slow polling.
+	metrics.print_summary(stdout);
+	if (backend) backend->print_summary(stdout);
+	backend.reset();	// Closes any recording.
 	return (errors);
 }
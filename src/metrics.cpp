@@ -0,0 +1,224 @@
+#include "metrics.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cstring>
+#include <cerrno>
+
+
+Metrics metrics;
+
+
+unsigned Histogram::bucket_of(uint64_t us) {
+	if (us < 4) return us;
+	const unsigned exponent = 63 - __builtin_clzll(us);	// At least 2.
+	const unsigned quarter = (us >> (exponent - 2)) & 0b11;
+	return (exponent - 1) * 4 + quarter;
+}
+
+uint64_t Histogram::bucket_upper_bound(unsigned i) {
+	i++;
+	if (i < 4) return i;
+	if (i >= Buckets - 4) return UINT64_MAX;
+	const unsigned exponent = i / 4 + 1, quarter = i % 4;
+	return (uint64_t)(4 + quarter) << (exponent - 2);
+}
+
+void Histogram::record(uint64_t us) {
+	buckets[bucket_of(us)].fetch_add(1, memory_order_relaxed);
+	total.fetch_add(1, memory_order_relaxed);
+	total_us.fetch_add(us, memory_order_relaxed);
+	uint64_t previous = largest.load(memory_order_relaxed);
+	while (us > previous && !largest.compare_exchange_weak(previous, us, memory_order_relaxed));
+}
+
+uint64_t Histogram::percentile(double p) const {
+	// Counts are read one by one while other threads record, so this is approximate under load.
+	const uint64_t n = count();
+	if (!n) return 0;
+	const uint64_t rank = std::max<uint64_t>(1, p * n + 0.5);
+	uint64_t seen = 0;
+	for (unsigned i = 0; i < Buckets; i++) {
+		seen += bucket(i);
+		if (seen >= rank) return min(bucket_upper_bound(i), max());
+	}
+	return max();
+}
+
+
+void Metrics::note_sequence(unsigned int sequence) {
+	// Unsigned subtraction handles the sequence number wrapping around.
+	const unsigned int previous = last_sequence.exchange(sequence, memory_order_relaxed);
+	if (previous) x_requests.add(sequence - previous);
+}
+
+static const char *Prefix = "dragonshooter_";
+
+string Metrics::prometheus() const {
+	string out;
+	char line[256];
+	for (auto c : counters) {
+		snprintf(line, sizeof(line), "# HELP %s%s %s\n# TYPE %s%s counter\n%s%s %lu\n",
+			Prefix, c->name, c->help, Prefix, c->name, Prefix, c->name, (unsigned long)c->get()
+		);
+		out += line;
+	}
+	for (auto g : gauges) {
+		snprintf(line, sizeof(line), "# HELP %s%s %s\n# TYPE %s%s gauge\n%s%s %ld\n",
+			Prefix, g->name, g->help, Prefix, g->name, Prefix, g->name, (long)g->get()
+		);
+		out += line;
+	}
+	for (auto h : histograms) {
+		snprintf(line, sizeof(line), "# HELP %s%s %s\n# TYPE %s%s histogram\n",
+			Prefix, h->name, h->help, Prefix, h->name
+		);
+		out += line;
+		// Empty buckets are left out. Prometheus only needs the cumulative count at each bound given.
+		uint64_t cumulative = 0;
+		for (unsigned i = 0; i < Histogram::Buckets - 4; i++) {
+			const uint64_t in_bucket = h->bucket(i);
+			if (!in_bucket) continue;
+			cumulative += in_bucket;
+			snprintf(line, sizeof(line), "%s%s_bucket{le=\"%g\"} %lu\n",
+				Prefix, h->name, Histogram::bucket_upper_bound(i) / 1e6, (unsigned long)cumulative
+			);
+			out += line;
+		}
+		snprintf(line, sizeof(line), "%s%s_bucket{le=\"+Inf\"} %lu\n%s%s_sum %g\n%s%s_count %lu\n",
+			Prefix, h->name, (unsigned long)h->count(),
+			Prefix, h->name, h->sum() / 1e6,
+			Prefix, h->name, (unsigned long)h->count()
+		);
+		out += line;
+	}
+	return out;
+}
+
+string Metrics::json() const {
+	string out = "{";
+	char field[256];
+	bool first = true;
+	for (auto c : counters) {
+		snprintf(field, sizeof(field), "%s\"%s\":%lu", first ? "" : ",", c->name, (unsigned long)c->get());
+		out += field;
+		first = false;
+	}
+	for (auto g : gauges) {
+		snprintf(field, sizeof(field), ",\"%s\":%ld", g->name, (long)g->get());
+		out += field;
+	}
+	for (auto h : histograms) {
+		snprintf(field, sizeof(field), ",\"%s\":{\"count\":%lu,\"sum\":%g,\"p50\":%g,\"p90\":%g,\"p99\":%g,\"max\":%g}",
+			h->name, (unsigned long)h->count(), h->sum() / 1e6,
+			h->percentile(0.5) / 1e6, h->percentile(0.9) / 1e6, h->percentile(0.99) / 1e6, h->max() / 1e6
+		);
+		out += field;
+	}
+	return out + "}\n";
+}
+
+void Metrics::print_summary(FILE *out) const {
+	for (auto c : counters) fprintf(out, "%-24s %lu\n", c->name, (unsigned long)c->get());
+	for (auto h : histograms) {
+		if (!h->count()) continue;
+		fprintf(out, "%-24s p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms (%lu samples)\n",
+			h->name,
+			h->percentile(0.5) / 1e3, h->percentile(0.9) / 1e3, h->percentile(0.99) / 1e3, h->max() / 1e3,
+			(unsigned long)h->count()
+		);
+	}
+}
+
+
+bool MetricsServer::start(const char *socket_path) {
+	sockaddr_un address = {.sun_family = AF_UNIX};
+	if (strlen(socket_path) >= sizeof(address.sun_path)) {
+		fprintf(stderr, "Metrics socket path is too long: \"%s\"\n", socket_path);
+		return false;
+	}
+	strcpy(address.sun_path, socket_path);
+
+	listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (listen_fd < 0) {
+		perror("Failed to create metrics socket");
+		return false;
+	}
+	unlink(socket_path);	// Left behind by an earlier run.
+	if (bind(listen_fd, (sockaddr*)&address, sizeof(address)) || listen(listen_fd, 4)) {
+		perror("Failed to listen on metrics socket");
+		close(listen_fd);
+		listen_fd = -1;
+		return false;
+	}
+	if (pipe2(stop_pipe, O_CLOEXEC)) {
+		perror("Failed to create metrics stop pipe");
+		close(listen_fd);
+		listen_fd = -1;
+		unlink(socket_path);
+		return false;
+	}
+	path = socket_path;
+	server_thread = thread(&MetricsServer::serve, this);
+	return true;
+}
+
+void MetricsServer::stop() {
+	if (!server_thread.joinable()) return;
+	const char wake = 0;
+	if (write(stop_pipe[1], &wake, 1) < 0) perror("Failed to stop metrics server");
+	server_thread.join();
+	for (int fd : {listen_fd, stop_pipe[0], stop_pipe[1]}) close(fd);
+	listen_fd = stop_pipe[0] = stop_pipe[1] = -1;
+	unlink(path.c_str());
+}
+
+void MetricsServer::serve() {
+	// One client at a time: a request is a single short read, and scrapes are infrequent.
+	static const int RequestTimeoutMs = 100;
+	pollfd fds[2] = {
+		{.fd = listen_fd, .events = POLLIN},
+		{.fd = stop_pipe[0], .events = POLLIN}
+	};
+	while (true) {
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR) continue;
+			perror("Failed to wait for metrics clients");
+			return;
+		}
+		if (fds[1].revents) return;
+		if (!(fds[0].revents & POLLIN)) continue;
+
+		const int client = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+		if (client < 0) continue;
+
+		// Clients that send nothing get the Prometheus text format.
+		char request[64] = {0};
+		pollfd client_fd = {.fd = client, .events = POLLIN};
+		if (poll(&client_fd, 1, RequestTimeoutMs) > 0) {
+			if (read(client, request, sizeof(request) - 1) < 0) request[0] = 0;
+		}
+
+		string response;
+		if (!strncmp(request, "json", 4)) response = metrics.json();
+		else if (!strncmp(request, "GET ", 4)) {
+			const bool want_json = strstr(request, ".json") || strstr(request, "format=json");
+			const string body = want_json ? metrics.json() : metrics.prometheus();
+			response = string("HTTP/1.0 200 OK\r\nContent-Type: ")
+				+ (want_json ? "application/json" : "text/plain; version=0.0.4")
+				+ "\r\nContent-Length: " + to_string(body.size())
+				+ "\r\n\r\n" + body;
+		}
+		else response = metrics.prometheus();
+
+		for (size_t sent = 0; sent < response.size();) {
+			const ssize_t n = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+			if (n <= 0) break;
+			sent += n;
+		}
+		close(client);
+	}
+}
@@ -0,0 +1,102 @@
+#include "pictures.h"
+#include <cstring>	// For strlen.
+
+
+static inline xcb_render_transform_t scale(float s, const FixedPosition &offset) {
+	xcb_render_transform_t t = mft(
+		1, 0, 0,
+		0, 1, 0,
+		0, 0, s
+	);
+	// Sampling from offset to the left and above moves the image right and down, by less than a pixel.
+	t.matrix13 = -offset.x;
+	t.matrix23 = -offset.y;
+	return t;
+}
+static inline xcb_render_transform_t scale_flip_x(float s, Distance width, const FixedPosition &offset) {
+	// Width is the destination width, so the flipped image starts at the left of the dragon's area.
+	xcb_render_transform_t t = mft(
+	 	  -1,     0,       width,
+		   0,     1,           0,
+		   0,     0,           s
+	);
+	t.matrix13 += offset.x;
+	t.matrix23 = -offset.y;
+	return t;
+}
+
+
+void DragonPictures::init(xcb_connection_t *c, xcb_render_pictformat_t f, SpriteAtlas *a) {
+	conn = c;
+	format = f;
+	atlas = a;
+}
+
+size_t DragonPictures::reserve(size_t slots) {
+	// Only bookkeeping: pictures are created unchecked as they are first drawn, so nothing here waits on the server.
+	lock_guard<mutex> lock(m);
+	if (sets.size() < slots) sets.resize(slots);
+	return sets.size();
+}
+
+void DragonPictures::release() {
+	lock_guard<mutex> lock(m);
+	for (auto &set : sets) for (auto &orientation : set.pages) for (auto &p : orientation) {
+		if (p.picture) xcb_render_free_picture(conn, p.picture);
+	}
+	sets.clear();
+}
+
+DragonPictures::Source DragonPictures::source_for(const DragonSnapshot &d, uint_fast64_t frame_number) {
+	const SpriteAtlas::Placement *at = atlas->place(d.frame, d.level, frame_number);
+	if (!at) return Source{XCB_NONE};
+
+	lock_guard<mutex> lock(m);
+	if (d.slot >= sets.size()) return Source{XCB_NONE};
+	const bool flipped = d.x_orient != Animation::natural_direction;
+	auto &pages = sets[d.slot].pages[flipped];
+	if (pages.size() <= at->page) pages.resize(at->page + 1, PagePicture{XCB_NONE});
+	PagePicture &p = pages[at->page];
+	if (!p.picture) {
+		p.picture = xcb_generate_id(conn);
+		xcb_render_create_picture(conn,
+			p.picture,		// pid
+			atlas->page(at->page),	// drawable
+			format,			// format
+			0,			// value_mask
+			NULL			// *value_list
+		);
+	}
+
+	// The level is drawn at the residual scale. Its level is fixed by the scale, so the scale alone says whether the transform is current.
+	// Positions between pixels are only drawn when filtering, as nearest sampling would round them away again.
+	const float residual = d.scale * (1 << d.level);
+	const FixedPosition offset = smooth ? d.subpixel : FixedPosition{0, 0};
+	if (p.scale != d.scale || p.offset.x != offset.x || p.offset.y != offset.y) {
+		xcb_render_set_picture_transform(conn,
+			p.picture,
+			flipped ? scale_flip_x(residual, d.width, offset) : scale(residual, offset)
+		);
+		p.scale = d.scale;
+		p.offset = offset;
+	}
+	if (p.smooth != smooth) {
+		const char *filter = smooth ? "bilinear" : "nearest";
+		xcb_render_set_picture_filter(conn,
+			p.picture,
+			strlen(filter),
+			filter,
+			0,		// Number of values.
+			NULL		// Values.
+		);
+		p.smooth = smooth;
+	}
+
+	// Composite coordinates are transformed with everything else, so the frame's position in the page is scaled to match.
+	// Mirroring negates x. Rounding moves the sprite less than half a pixel, and the gutter covers what it reveals.
+	const int16_t
+		x = lround(at->x * residual),
+		y = lround(at->y * residual)
+	;
+	return Source{p.picture, (int16_t)(flipped ? -x : x), y};
+}
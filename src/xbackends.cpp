@@ -0,0 +1,186 @@
+#include "xbackends.h"
+#include "metrics.h"
+#include <cstdio>	// For fprintf.
+#include <cstdlib>	// For free.
+
+
+bool XRenderBackend::init(xcb_connection_t *c, xcb_window_t w, xcb_gcontext_t window_gc, xcb_render_pictformat_t f, uint16_t target_width, uint16_t target_height, xcb_drawable_t bg) {
+	conn = c;
+	win = w;
+	gc = window_gc;
+	width = target_width;
+	height = target_height;
+	background = bg;
+	pictures.init(conn, f, &atlas);
+
+	target = xcb_generate_id(conn);	// Needed for transparency when there is no system compositor.
+	xcb_generic_error_t *err;
+	if ((err = xcb_request_check(conn, xcb_render_create_picture_checked(conn,
+		target,		// pid
+		win,		// drawable
+		f,		// format
+		0,		// value_mask
+		NULL		// *value_list
+	)))) {
+		fprintf(stderr, "Failed to create window picture.\n");
+		free(err);
+		target = 0;
+		return false;
+	}
+	return true;
+}
+
+bool XRenderBackend::upload_frames(const vector<FrameImage> &frames) {
+	atlas.init(conn, win, gc);
+	atlas.budget = sprite_budget;
+	if (!atlas.load(frames, cache_dir)) {
+		fprintf(stderr, "Failed to load image!\n");
+		return false;
+	}
+	return true;
+}
+
+void XRenderBackend::reserve_slots(size_t slots) {
+	pictures.reserve(slots);
+}
+
+void XRenderBackend::begin_frame(uint_fast64_t number) {
+	await_completion();
+	frame_number = number;
+	// Create clean picture of background:
+	if (background) {
+		xcb_copy_area(conn,
+			background,
+			win,
+			gc,
+			0, 0,
+			0, 0,
+			width,
+			height
+		);
+	} else {
+		xcb_clear_area(conn,
+			false,		// Trigger expose event.
+			win,
+			0, 0,
+			0, 0		// Zero extends to the window's edges.
+		);
+	}
+}
+
+void XRenderBackend::draw_sprite(const DragonSnapshot &d) {
+	const auto source = pictures.source_for(d, frame_number);
+	if (!source.picture) return;
+
+	// Load pixmap in window. Errors are reported through the event queue, rather than waited on for every dragon.
+	xcb_render_composite(conn,
+		XCB_RENDER_PICT_OP_OVER,		// Operation (PICTOP).
+		source.picture,				// Source (PICTURE).
+		source.picture,				// Mask (PICTURE or NONE).
+		target,					// Destination (PICTURE).
+		source.x, source.y,			// Source start coordinates (INT16).
+		source.x, source.y,			// Mask start coordinates (INT16)?
+		d.origin.x, d.origin.y,			// Destination start coordinates (INT16).
+		d.width, d.height			// Source dimensions to copy.
+	);
+}
+
+void XRenderBackend::draw_sparks(const vector<SparkSnapshot> &sparks) {
+	if (sparks.empty()) return;
+	spark_rects.resize(sparks.size());	// Keeps capacity.
+	for (size_t i = 0; i < sparks.size(); i++) {
+		spark_rects[i] = xcb_rectangle_t{sparks[i].x, sparks[i].y, sparks[i].size, sparks[i].size};
+	}
+	// Render colours are premultiplied, with 16 bits per channel.
+	static const xcb_render_color_t colour = {
+		(uint16_t)(((SparkColour >> 16) & 0xff) * 0x101),	// red
+		(uint16_t)(((SparkColour >> 8) & 0xff) * 0x101),	// green
+		(uint16_t)((SparkColour & 0xff) * 0x101),		// blue
+		(uint16_t)((SparkColour >> 24) * 0x101)			// alpha
+	};
+	xcb_render_fill_rectangles(conn,
+		XCB_RENDER_PICT_OP_OVER,	// Operation (PICTOP).
+		target,				// Destination (PICTURE).
+		colour,				// Colour (COLOR).
+		spark_rects.size(),		// Number of rectangles.
+		spark_rects.data()		// Rectangles.
+	);
+}
+
+void XRenderBackend::end_frame() {
+	// Collected later, so the next frame can be built while the server draws this one.
+	completion = xcb_get_input_focus(conn);
+	awaiting = true;
+	xcb_flush(conn);
+}
+
+void XRenderBackend::await_completion() {
+	if (!awaiting) return;
+	awaiting = false;
+	free(xcb_get_input_focus_reply(conn, completion, NULL));	// Errors are left to the event queue.
+	metrics.round_trips.add();
+}
+
+void XRenderBackend::release() {
+	if (awaiting) xcb_discard_reply(conn, completion.sequence);
+	awaiting = false;
+	pictures.release();
+	atlas.release();
+	if (target) xcb_render_free_picture(conn, target);
+	target = 0;
+}
+
+
+bool SoftwareBackend::init(xcb_connection_t *c, xcb_window_t w, xcb_gcontext_t window_gc, uint16_t width, uint16_t height, xcb_drawable_t bg) {
+	background = bg;
+	return compositor.init(c, w, window_gc, width, height, bg);
+}
+
+bool SoftwareBackend::upload_frames(const vector<FrameImage> &frames) {
+	// Every mip level is kept, as in the atlas, so small dragons are blended from a small source.
+	MipChains mips;
+	if (!mips.build(frames, cache_dir)) return false;
+	for (uint_fast8_t l = 0; l < Animation::mip_levels; l++) {
+		auto &level = compositor.sprites[l];
+		level.clear();
+		for (size_t f = 0; f < frames.size(); f++) {
+			if (l == 0) {
+				level.push_back(make_sprite(frames[f].width, frames[f].height, frames[f].bgra.data()));
+			} else {
+				const MipImage &m = mips.level(f, l);
+				level.push_back(make_sprite(m.width, m.height, m.bgra));
+			}
+		}
+	}
+	return true;
+}
+
+void SoftwareBackend::invalidate(int16_t x, int16_t y, uint16_t width, uint16_t height) {
+	if (background) invalidated.push_back(xcb_rectangle_t{x, y, width, height});
+}
+
+void SoftwareBackend::begin_frame(uint_fast64_t frame_number) {
+	if (!invalidated.empty()) {
+		compositor.update_background(background, invalidated);
+		invalidated.clear();
+	}
+	frame.frame_number = frame_number;
+	frame.dragons.clear();	// Keeps capacity.
+	frame.sparks.clear();
+}
+
+void SoftwareBackend::draw_sprite(const DragonSnapshot &d) {
+	frame.dragons.push_back(d);
+}
+
+void SoftwareBackend::draw_sparks(const vector<SparkSnapshot> &sparks) {
+	frame.sparks.assign(sparks.begin(), sparks.end());
+}
+
+void SoftwareBackend::end_frame() {
+	compositor.draw(frame);
+}
+
+void SoftwareBackend::release() {
+	compositor.release();
+}